@@ -13,21 +13,40 @@ ifneq ($(VTOP),)
 VFLAGS+=-s $(VTOP)
 endif
 
+# shared-memory transport for the C testbench, served by a VPI shim; the
+# text pipes are used otherwise. IOB_SHM tells the C testbench, and holds a
+# per-run nonce that both sides check, so a stale ring file is never mapped.
+ifeq ($(SHM),1)
+VFLAGS+=-DIOB_SHM
+VPI_MOD=iob_shm_vpi
+ifndef IOB_SHM
+IOB_SHM:=$(shell od -An -N4 -tu4 /dev/urandom | tr -d ' ')
+endif
+export IOB_SHM
+endif
+
 SIM_SERVER=$(IVSIM_SERVER)
 SIM_USER=$(IVSIM_USER)
 
 SIM_OBJ=a.out
 
-comp: $(SIM_OBJ)
+comp: $(SIM_OBJ) $(addsuffix .vpi,$(VPI_MOD))
 
 $(SIM_OBJ): $(VHDR) $(VSRC)
 	iverilog $(VFLAGS) $(VSRC)
 
+%.vpi: ./src/%.c ../../software/src/iob_shm.h
+	iverilog-vpi --name=$* -I../../software/src $<
+
 exec: comp
+ifneq ($(VPI_MOD),)
+	vvp -M. -m$(VPI_MOD) $(SIM_OBJ)
+else
 	./$(SIM_OBJ)
+endif
 
 clean: gen-clean
-	@rm -f $(SIM_OBJ)
+	@rm -f $(SIM_OBJ) *.vpi iob_shm.bin
 
 very-clean: clean
 
@@ -0,0 +1,131 @@
+/*
+ * SPDX-FileCopyrightText: 2025 IObundle
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+// VPI shim serving the C testbench over the shared-memory ring of iob_shm.h
+// (SHM=1 with Icarus). System tasks used by iob_v_tb.v:
+//   $iob_shm_open;                            wait for the ring and map it
+//   $iob_shm_get(mode, address, data_w, data) wait for the next request
+//   $iob_shm_put(data)                        serve it, with the read data
+// The simulation blocks while waiting, as it does on the text pipes.
+
+#include "iob_shm.h"
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vpi_user.h>
+
+static struct iob_shm *shm = NULL;
+
+// Value of the calling task's arguments, in order
+static void put_args(uint32_t *values, int n) {
+  vpiHandle args = vpi_iterate(vpiArgument, vpi_handle(vpiSysTfCall, NULL));
+  vpiHandle arg;
+  s_vpi_value v = {vpiIntVal};
+  int i;
+
+  if (!args)
+    return;
+  for (i = 0; i < n && (arg = vpi_scan(args)); i++) {
+    v.value.integer = values[i];
+    vpi_put_value(arg, &v, NULL, vpiNoDelay);
+  }
+  if (i == n)
+    vpi_free_object(args);
+}
+
+static uint32_t get_arg() {
+  vpiHandle args = vpi_iterate(vpiArgument, vpi_handle(vpiSysTfCall, NULL));
+  s_vpi_value v = {vpiIntVal};
+  vpiHandle arg;
+
+  if (!args)
+    return 0;
+  arg = vpi_scan(args);
+  if (!arg)
+    return 0; // the iterator is freed once exhausted
+  vpi_get_value(arg, &v);
+  vpi_free_object(args);
+  return v.value.integer;
+}
+
+static PLI_INT32 shm_open_calltf(PLI_BYTE8 *user_data) {
+  const char *env = getenv("IOB_SHM");
+  uint32_t nonce;
+  struct iob_shm *p;
+  int fd;
+
+  if (!env) {
+    vpi_printf("V: Error: IOB_SHM is not set\n");
+    vpi_control(vpiFinish, 1);
+    return 0;
+  }
+  nonce = strtoul(env, NULL, 10);
+  // the file only appears once initialized: see shm_start() in iob_c_tb.c.
+  // A ring from an earlier run has another nonce: wait for this run's.
+  for (;;) {
+    while ((fd = open(IOB_SHM_FILE, O_RDWR)) < 0)
+      usleep(1000);
+    p = mmap(NULL, sizeof(struct iob_shm), PROT_READ | PROT_WRITE, MAP_SHARED,
+             fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+      vpi_printf("V: Error: could not map %s\n", IOB_SHM_FILE);
+      vpi_control(vpiFinish, 1);
+      return 0;
+    }
+    if (__atomic_load_n(&p->magic, __ATOMIC_ACQUIRE) == IOB_SHM_MAGIC &&
+        p->nonce == nonce)
+      break;
+    munmap(p, sizeof(struct iob_shm));
+    usleep(1000);
+  }
+  shm = p;
+  unlink(IOB_SHM_FILE); // mapped: no stale ring for the next run
+  return 0;
+}
+
+static PLI_INT32 shm_get_calltf(PLI_BYTE8 *user_data) {
+  uint32_t tail = shm->tail;
+  struct iob_shm_req *slot = &shm->ring[tail % IOB_SHM_RING];
+  uint32_t values[4];
+
+  while (__atomic_load_n(&shm->head, __ATOMIC_ACQUIRE) == tail)
+    sched_yield();
+  values[0] = slot->mode;
+  values[1] = slot->addr;
+  values[2] = slot->data_w;
+  values[3] = slot->data;
+  put_args(values, 4);
+  return 0;
+}
+
+static PLI_INT32 shm_put_calltf(PLI_BYTE8 *user_data) {
+  uint32_t tail = shm->tail;
+
+  shm->ring[tail % IOB_SHM_RING].data = get_arg();
+  __atomic_store_n(&shm->tail, tail + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+static void iob_shm_register() {
+  s_vpi_systf_data tf = {vpiSysTask};
+
+  tf.tfname = "$iob_shm_open";
+  tf.calltf = shm_open_calltf;
+  vpi_register_systf(&tf);
+  tf.tfname = "$iob_shm_get";
+  tf.calltf = shm_get_calltf;
+  vpi_register_systf(&tf);
+  tf.tfname = "$iob_shm_put";
+  tf.calltf = shm_put_calltf;
+  vpi_register_systf(&tf);
+}
+
+void (*vlog_startup_routines[])() = {iob_shm_register, 0};
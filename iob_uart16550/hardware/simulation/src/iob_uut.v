@@ -22,7 +22,13 @@ module iob_uut #(
     input [32/8-1:0] iob_wstrb_i,
     output iob_rvalid_o,
     output [32-1:0] iob_rdata_o,
-    output iob_ready_o
+    output iob_ready_o,
+    // interrupt_o: UART16550 #0 (bit 0) and #1 (bit 1) interrupts
+    output [2-1:0] interrupt_o,
+    // line: RS232 line model on UART16550 #1, RX driven by it when line_en_i
+    input line_en_i,
+    input line_rxd_i,
+    output line_txd_o
 );
 
 // uart16550 #0 CSRs interface
@@ -73,10 +79,12 @@ module iob_uut #(
     wire uart1_rs232_cts;
 
 
-        assign uart1_rs232_rxd = uart0_rs232_txd;
+        assign uart1_rs232_rxd = line_en_i ? line_rxd_i : uart0_rs232_txd;
         assign uart0_rs232_rxd = uart1_rs232_txd;
         assign uart0_rs232_cts = 1'b1;
         assign uart1_rs232_cts = 1'b1;
+        assign interrupt_o = {uart16550_1_interrupt, uart16550_0_interrupt};
+        assign line_txd_o = uart1_rs232_txd;
             
 
         // Convert IOb port from testbench into correct interface for UART CSRs bus
@@ -43,7 +43,11 @@ module iob_uvm_tb;
       .iob_wstrb_i (vif.iob_wstrb_i),
       .iob_rvalid_o(vif.iob_rvalid_o),
       .iob_rdata_o (vif.iob_rdata_o),
-      .iob_ready_o (vif.iob_ready_o)
+      .iob_ready_o (vif.iob_ready_o),
+      .interrupt_o (),
+      .line_en_i   (1'b0),
+      .line_rxd_i  (1'b1),
+      .line_txd_o  ()
    );
 
    initial begin
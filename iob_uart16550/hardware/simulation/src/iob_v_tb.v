@@ -65,6 +65,21 @@ module iob_v_tb;
       arst = 0;
       #10;
 
+`ifdef IOB_SHM
+      // Shared-memory ring (SHM=1): requests served through the VPI shim
+      $iob_shm_open;
+      while (1) begin
+         $iob_shm_get(mode, address, data_w, data);
+         if (mode == `F) begin  //finish request
+            $display("V: finish request");
+            $finish;
+         end
+         if (mode == `R) iob_read(address, data, data_w);
+         else iob_write(address, data, data_w);
+         $iob_shm_put(data);
+      end
+`endif
+
       // Open IPC files
       while (c2v_read_fp == 0) begin
          c2v_read_fp = $fopen("c2v.txt", "rb");
@@ -132,7 +147,11 @@ module iob_v_tb;
       .iob_wstrb_i (iob_wstrb_i),
       .iob_rvalid_o(iob_rvalid_o),
       .iob_rdata_o (iob_rdata_o),
-      .iob_ready_o (iob_ready_o)
+      .iob_ready_o (iob_ready_o),
+      .interrupt_o (),
+      .line_en_i   (1'b0),
+      .line_rxd_i  (1'b1),
+      .line_txd_o  ()
    );
 
    // Write data to IOb Native subordinate
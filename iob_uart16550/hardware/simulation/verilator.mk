@@ -52,9 +52,38 @@ else
 VFLAGS+=--main
 VFLAGS+=--timing
 endif
+# FST=1 with VCD=1 dumps FST instead, written by a separate thread
 ifeq ($(VCD),1)
+ifeq ($(FST),1)
+VFLAGS+=--trace-fst --trace-threads 2 -DVCD
+else
 VFLAGS+=--trace -DVCD
 endif
+endif
+
+# optimized model: VLT_FAST=1, multithreaded with VLT_THREADS=<N>
+VLT_FAST_FLAGS=-O3 --x-assign fast --x-initial fast --noassert
+VLT_FAST_MAKE=OPT_FAST="-O3" OPT_SLOW="-O1" OPT_GLOBAL="-O3"
+ifeq ($(VLT_FAST),1)
+VFLAGS+=$(VLT_FAST_FLAGS)
+VLT_MAKE_FLAGS+=$(VLT_FAST_MAKE)
+endif
+ifneq ($(VLT_THREADS),)
+VLT_THREADS_FLAGS=--threads $(VLT_THREADS)
+endif
+# thread counts compared by vlt-bench
+VLT_BENCH_THREADS ?=1 2 4
+
+# savable model, for +checkpoint_save=<file> and +checkpoint_restore=<file>
+ifeq ($(SAVABLE),1)
+VFLAGS+=--savable -CFLAGS -DVLT_SAVABLE
+endif
+
+# runtime plusargs, for example the trace window: VLT_ARGS="+trace_on_error"
+# or a checkpoint: VLT_ARGS="+checkpoint_restore=init.ckpt"
+# +pty bridges UART16550 #1 to a pseudo-terminal, e.g. for console -s <pty>
+# +bus_depth=<n> sets the reads the bus-functional model keeps in flight
+VLT_ARGS ?=
 
 ifeq ($(COV),1)
 VFLAGS+=--coverage
@@ -64,15 +93,30 @@ COV_MERGE=merged.dat
 endif
 
 comp: $(VHDR) $(VSRC) $(COBJ)
-	verilator $(VFLAGS) $(VSRC)
-	cd ./obj_dir && make -f $(SIM_OBJ).mk
+	verilator $(VFLAGS) $(VLT_THREADS_FLAGS) $(VSRC)
+	cd ./obj_dir && make -f $(SIM_OBJ).mk $(VLT_MAKE_FLAGS)
 
 exec: comp
-	./obj_dir/$(SIM_OBJ) $(COV_ARG)
+	./obj_dir/$(SIM_OBJ) $(COV_ARG) $(VLT_ARGS)
 ifeq ($(COV),1)
 	make cov-analyze
 endif
 
+# build the optimized model for each of VLT_BENCH_THREADS and compare the
+# simulation rates, to tell whether partitioning the model pays off. A rate
+# only counts if its run exits cleanly and its test.log passes.
+vlt-bench: $(VHDR) $(VSRC) $(COBJ)
+	@rm -f vlt_bench.txt
+	@for t in $(VLT_BENCH_THREADS); do \
+	  verilator $(VFLAGS) $(VLT_FAST_FLAGS) --threads $$t --Mdir obj_dir_t$$t $(VSRC) && \
+	  make -s -C obj_dir_t$$t -f $(SIM_OBJ).mk $(VLT_FAST_MAKE) > /dev/null || exit 1; \
+	  rm -f test.log; \
+	  ./obj_dir_t$$t/$(SIM_OBJ) > vlt_bench.out || { cat vlt_bench.out; exit 1; }; \
+	  grep -q "Test passed!" test.log || { echo "threads $$t: Test failed!"; exit 1; }; \
+	  sed -n "s/.*(\([0-9]*\) cycles\/s)/$$t \1/p" vlt_bench.out >> vlt_bench.txt; \
+	done
+	@awk 'NR == 1 {base = $$2} {printf "threads %s: %s cycles/s (x%.2f)\n", $$1, $$2, base ? $$2 / base : 0}' vlt_bench.txt
+
 cov-analyze: $(COV_RPT)
 	# merge coverage
 	verilator_coverage --write $(COV_MERGE) $(COV_RPT)
@@ -86,9 +130,9 @@ cov-analyze: $(COV_RPT)
 	$(CUSTOM_COVERAGE)
 
 clean: gen-clean
-	@rm -rf obj_dir
+	@rm -rf obj_dir obj_dir_t* vlt_bench.txt vlt_bench.out
 	@rm -rf *.dat cov_annotated # coverage outputs
 
 very-clean: clean
 
-.PHONY: comp exec clean cov-analyze
+.PHONY: comp exec clean cov-analyze vlt-bench
@@ -39,6 +39,7 @@ module iob_uart16550 #(
    wire [ADDR_W-1:0] internal_wb_adr;
    wire              internal_wb_cyc;
    wire [  32/8-1:0] internal_wb_sel;
+   wire [  32/8-1:0] internal_wb_sel_byte;  // LOCAL PATCH, see below
    wire              internal_wb_stb;
    wire              internal_wb_we;
    // RS232 interface
@@ -62,6 +63,15 @@ module iob_uart16550 #(
    assign internal_rs232_ri  = 1'b0;
    assign internal_rs232_dcd = 1'b0;
 
+   // LOCAL PATCH, not produced by Py2HWSW: carry it over when regenerating.
+   // The converter is generated with READ_BYTES=1, so reads enable one byte
+   // lane. Reads from the debug registers (addresses 8 to 15) select all
+   // lanes so that the 32-bit debug words are returned; the driver's FIFO
+   // levels and the CSR snapshot depend on it. test_read_debug_regs() in
+   // iob_core_tb.c fails without it.
+   assign internal_wb_sel    = (~internal_wb_we && (internal_wb_adr[4:3] == 2'b01)) ?
+                               4'hF : internal_wb_sel_byte;
+
 
    // Convert CSRs interface into internal wishbone bus
    iob_universal_converter_iob_wb #(
@@ -87,7 +97,7 @@ module iob_uart16550 #(
       .wb_ack_i    (internal_wb_ack),
       .wb_adr_o    (internal_wb_adr),
       .wb_cyc_o    (internal_wb_cyc),
-      .wb_sel_o    (internal_wb_sel),
+      .wb_sel_o    (internal_wb_sel_byte),  // LOCAL PATCH
       .wb_stb_o    (internal_wb_stb),
       .wb_we_o     (internal_wb_we)
    );
@@ -10,6 +10,8 @@ import signal
 import importlib.util
 import time
 import select
+import struct
+import zlib
 from threading import Thread
 import subprocess
 
@@ -25,6 +27,38 @@ ACK = b"\x06"  # Acknowledgement in Hexadecimal
 FTX = b"\x07"  # Receive file request
 FRX = b"\x08"  # Send file request
 DC1 = b"\x11"  # Device Control 1 <-> Receive request to disable iob-soc exclusive message identifiers
+SOH = b"\x01"  # Start of Heading <-> start of a file transfer block
+FTXB = b"\x0e"  # Receive file request, framed protocol
+FRXB = b"\x0f"  # Send file request, framed protocol
+NAK = b"\x15"  # Negative Acknowledgement <-> block must be resent
+SYN = b"\x16"  # Synchronous Idle <-> framed protocol support probe
+STATS = b"\x10"  # Link statistics report
+STATS_NAMES = [
+    "tx_bytes",
+    "rx_bytes",
+    "overrun",
+    "parity",
+    "framing",
+    "break",
+    "lsr_reads",
+    "tx_wait",
+    "rx_wait",
+]  # Words of struct uart16550_stats, in order
+FRXZ = b"\x12"  # Send file request, compressed
+FRXS = b"\x13"  # Send file request, paced by chunk
+BRC = b"\x14"  # Baud rate change request
+BAUD_PATTERN = bytes(
+    [0x55, 0xAA, 0x00, 0xFF, 0x0F, 0xF0, 0x33, 0xCC]
+    + [0x01, 0x80, 0x7E, 0x81, 0x5A, 0xA5, 0x3C, 0xC3]
+)  # Test pattern sent at the new baud rate
+BAUD_TIMEOUT = 0.1  # Seconds to wait for the echo of the test pattern
+FRAME_HDR = 0xFFFFFFFF  # Index of the block that carries the file size
+FRAME_SIZE = 256  # Payload bytes per block
+FRAME_WINDOW = 16  # Blocks in flight
+FRAME_TIMEOUT = 0.5  # Seconds without traffic before resending (serial only)
+LZ_WINDOW = 0xFFFF  # Maximum match offset of compressed transfers
+LZ_TIMEOUT = 5.0  # Seconds to wait for the CRC32 verdict on a compressed file (serial only)
+compress = False
 
 
 def tb_write(data, number_of_bytes=1, is_file=False):
@@ -152,6 +186,340 @@ def cnsl_recvfile():
     print(": file received")
 
 
+def cnsl_write(data):
+    if SerialFlag:
+        ser.write(data)
+    else:
+        tb_write(data, len(data))
+
+
+# Read up to number_of_bytes; returns fewer on timeout (serial only, the
+# simulation link is lossless and always blocks)
+def cnsl_read(number_of_bytes, timeout=None):
+    if not SerialFlag:
+        return tb_read.read(number_of_bytes)
+    ser.timeout = timeout
+    data = ser.read(number_of_bytes)
+    ser.timeout = None
+    return data
+
+
+def frame_crc(data):
+    return struct.pack("<I", zlib.crc32(data) & 0xFFFFFFFF)
+
+
+def frame_send(idx, payload):
+    body = struct.pack("<IH", idx, len(payload)) + payload
+    cnsl_write(SOH + body + frame_crc(body))
+
+
+def ctrl_send(ctrl, idx):
+    body = ctrl + struct.pack("<I", idx)
+    cnsl_write(body + frame_crc(body))
+
+
+# Wait for a block; returns (idx, payload), None on timeout or corruption,
+# EOT, or any other byte that is not the start of a block
+def frame_recv(timeout):
+    byte = cnsl_read(1, timeout)
+    if byte != SOH:
+        return byte if byte else None
+    hdr = cnsl_read(6, timeout)
+    if len(hdr) != 6:
+        return None
+    idx, length = struct.unpack("<IH", hdr)
+    if length > FRAME_SIZE:
+        return None
+    rest = cnsl_read(length + 4, timeout)
+    if len(rest) != length + 4:
+        return None
+    if frame_crc(hdr + rest[:length]) != rest[length:]:
+        return (idx, None)
+    return (idx, rest[:length])
+
+
+# Wait for an ACK or NAK; returns (ctrl, idx), None on timeout or corruption,
+# or any other byte
+def ctrl_recv(timeout):
+    byte = cnsl_read(1, timeout)
+    if byte != ACK and byte != NAK:
+        return byte if byte else None
+    rest = cnsl_read(8, timeout)
+    if len(rest) != 8 or frame_crc(byte + rest[:4]) != rest[4:]:
+        return None
+    return (byte, struct.unpack("<I", rest[:4])[0])
+
+
+def frame_progress(done, total, percentage):
+    new_percentage = int(100 * done / total) if total else 100
+    if new_percentage // 10 != percentage // 10:
+        print("%3d %c" % (new_percentage, "%"))
+    return new_percentage
+
+
+# Send file to target with the framed protocol
+def cnsl_sendfile_framed():
+    name = cnsl_recvstr()
+    f = open(name, "rb")
+    data = f.read()
+    f.close()
+    file_size = len(data)
+    nblocks = (file_size + FRAME_SIZE - 1) // FRAME_SIZE
+    print(PROGNAME, end="")
+    print(": file of size {0} bytes".format(file_size))
+
+    def block(idx):
+        return data[idx * FRAME_SIZE : (idx + 1) * FRAME_SIZE]
+
+    # send file size until acknowledged
+    while True:
+        frame_send(FRAME_HDR, struct.pack("<I", file_size))
+        ctrl = ctrl_recv(FRAME_TIMEOUT)
+        if ctrl == (ACK, FRAME_HDR):
+            break
+
+    base = 0
+    nxt = 0
+    acked = set()
+    percentage = 0
+    while base < nblocks:
+        while nxt < nblocks and nxt - base < FRAME_WINDOW:
+            frame_send(nxt, block(nxt))
+            nxt += 1
+        ctrl = ctrl_recv(FRAME_TIMEOUT)
+        if ctrl is None:
+            # resend whatever the target did not acknowledge
+            for idx in range(base, nxt):
+                if idx not in acked:
+                    frame_send(idx, block(idx))
+            continue
+        if not isinstance(ctrl, tuple) or not base <= ctrl[1] < nxt:
+            continue
+        if ctrl[0] == ACK:
+            acked.add(ctrl[1])
+            while base in acked:
+                acked.remove(base)
+                base += 1
+            percentage = frame_progress(base, nblocks, percentage)
+        elif ctrl[1] not in acked:
+            frame_send(ctrl[1], block(ctrl[1]))
+
+    # end transfer; the target answers with its progress message
+    cnsl_write(EOT)
+    while True:
+        ctrl = ctrl_recv(FRAME_TIMEOUT)
+        if ctrl is None:
+            cnsl_write(EOT)
+        elif not isinstance(ctrl, tuple):
+            print(str(ctrl, "iso-8859-1"), end="", flush=True)
+            break
+    print(PROGNAME, end="")
+    print(": file sent")
+
+
+# Receive file from target with the framed protocol
+def cnsl_recvfile_framed():
+    name = cnsl_recvstr()
+    file_size = None
+    nblocks = 0
+    base = 0
+    blocks = {}
+    percentage = 0
+    while True:
+        frame = frame_recv(FRAME_TIMEOUT)
+        if frame is None:
+            # report the window so the target resends lost blocks or ACKs
+            if file_size is None:
+                ctrl_send(NAK, FRAME_HDR)
+            for idx in range(max(base - FRAME_WINDOW, 0), base):
+                ctrl_send(ACK, idx)
+            for idx in range(base, min(base + FRAME_WINDOW, nblocks)):
+                ctrl_send(ACK if idx in blocks else NAK, idx)
+            continue
+        if not isinstance(frame, tuple):
+            if file_size is not None and base == nblocks:
+                # EOT, or the target message if the EOT was lost
+                if frame != EOT:
+                    print(str(frame, "iso-8859-1"), end="", flush=True)
+                break
+            continue
+        idx, payload = frame
+        if payload is None:
+            ctrl_send(NAK, idx)
+        elif idx == FRAME_HDR:
+            if file_size is None and len(payload) == 4:
+                file_size = struct.unpack("<I", payload)[0]
+                nblocks = (file_size + FRAME_SIZE - 1) // FRAME_SIZE
+                print(PROGNAME, end=" ")
+                print(": file size: {0} bytes".format(file_size))
+            ctrl_send(ACK, idx)
+        elif file_size is not None and idx < nblocks:
+            blocks[idx] = payload
+            ctrl_send(ACK, idx)
+            while base in blocks:
+                base += 1
+            percentage = frame_progress(base, nblocks, percentage)
+
+    f = open(name, "wb")
+    f.write(b"".join(blocks[idx] for idx in range(nblocks)))
+    f.close()
+    print(PROGNAME, end="")
+    print(": file received")
+
+
+# Append an LZ length nibble overflow: 255s and the remainder
+def lz_len(out, length):
+    if length >= 15:
+        length -= 15
+        while length >= 255:
+            out.append(255)
+            length -= 255
+        out.append(length)
+
+
+# Greedy LZ compression in the LZ4 block layout (see uart16550_recvfile)
+def lz_compress(data):
+    out = bytearray()
+    table = {}
+    n = len(data)
+    anchor = 0
+    i = 0
+    while i + 4 <= n:
+        key = data[i : i + 4]
+        cand = table.get(key)
+        table[key] = i
+        if cand is None or i - cand > LZ_WINDOW:
+            i += 1
+            continue
+        match = 4
+        while i + match < n and data[cand + match] == data[i + match]:
+            match += 1
+        literals = i - anchor
+        out.append((min(literals, 15) << 4) | min(match - 4, 15))
+        lz_len(out, literals)
+        out += data[anchor:i]
+        out += (i - cand).to_bytes(2, byteorder="little")
+        lz_len(out, match - 4)
+        i += match
+        anchor = i
+    literals = n - anchor
+    out.append(min(literals, 15) << 4)
+    lz_len(out, literals)
+    out += data[anchor:]
+    return bytes(out)
+
+
+# Wait for the ACK that starts a compressed transfer attempt; sending anyway
+# after LZ_TIMEOUT also covers a lost ACK
+def lz_wait_ack():
+    byte = cnsl_read(1, LZ_TIMEOUT)
+    while byte and byte != ACK:
+        byte = cnsl_read(1, LZ_TIMEOUT)
+
+
+# Send compressed file to target
+def cnsl_sendfile_lz():
+    name = cnsl_recvstr()
+    f = open(name, "rb")
+    data = f.read()
+    f.close()
+    file_size = len(data)
+    stream = lz_compress(data)
+    print(PROGNAME, end="")
+    print(
+        ": file of size {0} bytes, compressed to {1} bytes".format(
+            file_size, len(stream)
+        )
+    )
+    cnsl_write(struct.pack("<II", file_size, len(stream)))
+    lz_wait_ack()
+    while True:
+        if SerialFlag:
+            ser.write(stream)
+        else:
+            tb_write(stream, len(stream), True)
+        cnsl_write(frame_crc(data))
+        if SerialFlag:
+            ser.flush()
+        # ACK once the CRC32 matches, NAK then ACK to resend; no answer means
+        # bytes were lost and the target still waits for the rest
+        byte = cnsl_read(1, LZ_TIMEOUT)
+        if byte == ACK:
+            break
+        print(PROGNAME, end="")
+        if byte == NAK:
+            print(": CRC mismatch, resending")
+            lz_wait_ack()
+        else:
+            print(": no answer, resending")
+    print(PROGNAME, end="")
+    print(": file sent")
+
+
+# Send file to target one chunk per ACK
+def cnsl_sendfile_stream():
+    name = cnsl_recvstr()
+    chunk = int.from_bytes(cnsl_read(4), byteorder="little", signed=False)
+    f = open(name, "rb")
+    file_size = os.path.getsize(name)
+    print(PROGNAME, end="")
+    print(": file of size {0} bytes, {1} byte chunks".format(file_size, chunk))
+    cnsl_write(file_size.to_bytes(4, byteorder="little"))
+    sent = 0
+    percentage = 0
+    while sent < file_size:
+        while cnsl_read(1) != ACK:
+            pass
+        data = f.read(chunk)
+        cnsl_write(data)
+        sent += len(data)
+        percentage = frame_progress(sent, file_size, percentage)
+    f.close()
+    print(PROGNAME, end="")
+    print(": file sent")
+
+
+# Print the link statistics reported by the target
+def cnsl_print_stats():
+    count = cnsl_read(1)[0]
+    words = struct.unpack("<{0}I".format(count), cnsl_read(4 * count))
+    print(PROGNAME, end="")
+    print(": link statistics")
+    for i, value in enumerate(words):
+        name = STATS_NAMES[i] if i < len(STATS_NAMES) else "word{0}".format(i)
+        print("  {0:<10} = {1}".format(name, value))
+
+
+# Switch to a faster baud rate requested by the target and verify it
+def cnsl_upshift():
+    mult = cnsl_read(1)[0]
+    if not SerialFlag or mult < 2:
+        cnsl_write(NAK)
+        return
+    baudrate = ser.baudrate
+    ser.write(ACK)
+    ser.flush()
+    try:
+        ser.baudrate = baudrate * mult
+    except Exception:
+        # the target misses the pattern and falls back
+        pass
+    ser.reset_input_buffer()
+    ser.write(BAUD_PATTERN)
+    if cnsl_read(len(BAUD_PATTERN), BAUD_TIMEOUT) == BAUD_PATTERN:
+        ser.write(ACK)
+        ser.flush()
+        # the target confirms that it got the ACK and keeps the new rate
+        if cnsl_read(1, BAUD_TIMEOUT) == ACK:
+            print(PROGNAME, end="")
+            print(": baud rate set to {0}".format(ser.baudrate))
+            return
+    ser.baudrate = baudrate
+    ser.reset_input_buffer()
+    print(PROGNAME, end="")
+    print(": baud rate {0} failed, keeping {1}".format(baudrate * mult, baudrate))
+
+
 def getUserInput():
     stdin = sys.stdin
     while 1:
@@ -169,15 +537,30 @@ def endFileTransfer():
     global DC1
     global FTX
     global FRX
+    global SYN
+    global FTXB
+    global FRXB
+    global FRXZ
+    global FRXS
+    global BRC
+    global STATS
     DC1 = None
     FTX = None
     FRX = None
+    SYN = None
+    FTXB = None
+    FRXB = None
+    FRXZ = None
+    FRXS = None
+    BRC = None
+    STATS = None
 
 
 def usage(message):
     print(
         "{}:{}".format(
-            PROGNAME, "usage: ./console.py -s <serial port> [ -f ] [ -L/--local ]"
+            PROGNAME,
+            "usage: ./console.py -s <serial port> [ -f ] [ -L/--local ] [ -z ]",
         )
     )
     cnsl_perror(message)
@@ -277,6 +660,7 @@ def init_console():
     global SerialFlag
     global ser
     global debug
+    global compress
 
     if "-L" in sys.argv or "--local" in sys.argv:
         SerialFlag = False
@@ -303,6 +687,8 @@ def init_console():
 
     if "-d" in sys.argv:
         debug = True
+    if "-z" in sys.argv:
+        compress = True
 
     init_print()
 
@@ -352,6 +738,31 @@ def main():
         elif byte == FRX:
             print(f"{PROGNAME}: got file send request")
             cnsl_sendfile()
+        elif byte == SYN:
+            # announce the protocol extensions supported before the ACK
+            caps = SYN
+            if compress:
+                caps += FRXZ
+            caps += FRXS + STATS
+            if SerialFlag:
+                caps += BRC
+            cnsl_write(caps)
+        elif byte == FTXB:
+            print(f"{PROGNAME}: got framed file receive request")
+            cnsl_recvfile_framed()
+        elif byte == FRXB:
+            print(f"{PROGNAME}: got framed file send request")
+            cnsl_sendfile_framed()
+        elif byte == FRXZ:
+            print(f"{PROGNAME}: got compressed file send request")
+            cnsl_sendfile_lz()
+        elif byte == FRXS:
+            print(f"{PROGNAME}: got streamed file send request")
+            cnsl_sendfile_stream()
+        elif byte == STATS:
+            cnsl_print_stats()
+        elif byte == BRC:
+            cnsl_upshift()
         elif byte == DC1:
             print(f"{PROGNAME}: disabling IOB-SOC exclusive identifiers")
             endFileTransfer()
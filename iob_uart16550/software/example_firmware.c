@@ -10,6 +10,10 @@
 #define FREQ 100000000
 #define BAUD 3000000
 
+// Character output of printf: buffered, so printing returns at once while the
+// TX FIFO has room. uart16550_finish() sends whatever is left.
+void _putchar(char character) { uart16550_bputc(character); }
+
 int main() {
   // Init uart16550
   uart16550_init(UART16550_BASE, FREQ / BAUD);
@@ -4,10 +4,17 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include "iob_shm.h"
+#include "iob_tb_services.h"
+#include "iob_uart16550_csrs.h"
+
+#include <fcntl.h> // For open
+#include <sched.h> // For sched_yield
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>   // For memset
+#include <sys/mman.h> // For mmap
 #include <sys/stat.h> // For mkfifo
 #include <time.h>
 #include <unistd.h>
@@ -25,6 +32,16 @@ static FILE *fpr;
 
 static uint32_t req = 0;
 
+// Requests sent, ahead of req while a batch is in flight
+static uint32_t sent = 0;
+
+// Shared-memory ring, when the simulator runs with SHM=1 (IOB_SHM set in the
+// environment to the run nonce); NULL selects the text protocol
+static struct iob_shm *shm = NULL;
+
+// Bus transactions issued by the core testbench
+static uint32_t bus_transactions = 0;
+
 void my_usleep(int microseconds) {
   struct timespec req = {0};
   req.tv_sec = microseconds / 1000000;
@@ -32,73 +49,179 @@ void my_usleep(int microseconds) {
   nanosleep(&req, NULL);
 }
 
-// Function to write to the c2v file
-void iob_write(uint32_t address, uint32_t data_w, uint32_t data) {
+// Post a request in the shared-memory ring
+static void shm_send(uint32_t mode, uint32_t address, uint32_t data_w,
+                     uint32_t data) {
+  uint32_t head = shm->head;
+  struct iob_shm_req *slot = &shm->ring[head % IOB_SHM_RING];
 
-  uint32_t ack = -100, mode = -100, addr = -100, dat_w = -100, dat = -100;
-  int fscanf_ret, fread_ret;
-  char buf[45];
+  while (head - __atomic_load_n(&shm->tail, __ATOMIC_ACQUIRE) >= IOB_SHM_RING)
+    sched_yield();
+  slot->mode = mode;
+  slot->addr = address;
+  slot->data_w = data_w;
+  slot->data = data;
+  __atomic_store_n(&shm->head, head + 1, __ATOMIC_RELEASE);
+}
 
-  // send request
-  fprintf(fpw, "%08x %08x %08x %08x %08x\n", req, W, address, data_w, data);
+// Wait for the oldest pending request in the shared-memory ring to be served
+static uint32_t shm_recv() {
+  while (__atomic_load_n(&shm->tail, __ATOMIC_ACQUIRE) == req)
+    sched_yield();
+  return shm->ring[req++ % IOB_SHM_RING].data;
+}
+
+// Send a request to the c2v file
+static void iob_send(uint32_t mode, uint32_t address, uint32_t data_w,
+                     uint32_t data) {
+  bus_transactions++;
+  if (shm) {
+    shm_send(mode, address, data_w, data);
+    return;
+  }
+  fprintf(fpw, "%08x %08x %08x %08x %08x\n", sent++, mode, address, data_w,
+          data);
+}
+
+// Hand the sent requests over to the simulator
+static void iob_flush() {
+  if (shm)
+    return;
   fflush(fpw);
-  // printf("C: New Write request %d: %08x %08x\n", req, address, data); //
-  // DEBUG
   my_usleep(100);
+}
 
-  // wait for ack
+// Wait for the ack of the oldest pending request in the v2c file
+static uint32_t iob_recv(uint32_t mode, uint32_t address, uint32_t data) {
+
+  uint32_t ack = -100, md = -100, addr = -100, dat_w = -100, dat = -100;
+  int fscanf_ret, fread_ret;
+  char buf[45];
+
+  if (shm)
+    return shm_recv();
   fread_ret = fread(buf, sizeof(char), 45, fpr);
   if (fread_ret != 45)
     exit(1);
-  fscanf_ret = sscanf(buf, "%08x %08x %08x %08x %08x\n", &ack, &mode, &addr,
+  fscanf_ret = sscanf(buf, "%08x %08x %08x %08x %08x\n", &ack, &md, &addr,
                       &dat_w, &dat);
   if (fscanf_ret != 5)
     exit(1);
-  if (ack != req || mode != W || addr != address || dat != data) {
+  if (ack != req || md != mode || addr != address ||
+      (mode == W && dat != data)) {
     printf("C: Error: These values should be equal: ack/req:%d==%d mode:%d==%d "
            "addr:%d==%d dat:%d==%d\n",
-           ack, req, mode, W, addr, address, dat, data);
+           ack, req, md, mode, addr, address, dat, data);
     exit(1);
   }
 
-  // printf("C: Written %d: %08x to %08x\n", req, data, address); // DEBUG
+  // printf("C: Ack %d: %08x %08x\n", req, address, dat); // DEBUG
   req++;
+  return dat;
 }
 
-// Function to read from the v2c file
-uint32_t iob_read(uint32_t address, uint32_t data_w) {
+// Function to write to the c2v file
+void iob_write(uint32_t address, uint32_t data_w, uint32_t data) {
+  // send request
+  iob_send(W, address, data_w, data);
+  iob_flush();
 
-  uint32_t ack = -100, mode = -100, addr = -100, dat_w = -100, dat = -100;
-  int fscanf_ret, fread_ret;
-  char buf[45];
+  // wait for ack
+  iob_recv(W, address, data);
+}
 
+// Function to read from the v2c file
+uint32_t iob_read(uint32_t address, uint32_t data_w) {
   // send request
-  fprintf(fpw, "%08x %08x %08x %08x %08x\n", req, R, address, data_w, 0);
-  fflush(fpw);
-  // printf("C: New Read requested %d: %08x\n", req, address); // DEBUG
-  my_usleep(100);
+  iob_send(R, address, data_w, 0);
+  iob_flush();
 
   // wait for ack
-  fread_ret = fread(buf, sizeof(char), 45, fpr);
-  if (fread_ret != 45)
-    exit(1);
-  fscanf_ret = sscanf(buf, "%08x %08x %08x %08x %08x\n", &ack, &mode, &addr,
-                      &dat_w, &dat);
-  if (fscanf_ret != 5)
+  return iob_recv(R, address, 0);
+}
+
+// Batch of accesses in one round trip: all requests are sent before the
+// first ack is awaited, the Verilog side serves them in order
+void iob_batch(struct iob_uart16550_csrs_op *ops, uint32_t n) {
+  uint32_t i;
+
+  for (i = 0; i < n; i++)
+    iob_send(ops[i].write ? W : R, ops[i].addr, ops[i].data_w, ops[i].value);
+  iob_flush();
+
+  for (i = 0; i < n; i++) {
+    if (ops[i].write)
+      iob_recv(W, ops[i].addr, ops[i].value);
+    else
+      ops[i].value = iob_recv(R, ops[i].addr, 0);
+  }
+}
+
+// Number of bus transactions issued so far
+uint32_t iob_bus_transactions() { return bus_transactions; }
+
+// The file link carries no interrupt lines: callers fall back to polling
+int iob_wait_irq(uint32_t mask) {
+  (void)mask;
+  return 0;
+}
+
+// Trace windows are set on the Verilog side: nothing to trigger here
+void iob_trace_trigger() {}
+
+// No model checkpoints with the Verilog testbench
+void iob_checkpoint() {}
+int iob_restore() { return 0; }
+
+// No RS232 line model with the Verilog testbench
+int iob_line_config(uint32_t cycles_per_bit, uint32_t lcr, uint32_t gap) {
+  (void)cycles_per_bit;
+  (void)lcr;
+  (void)gap;
+  return 0;
+}
+void iob_line_send(const void *buf, uint32_t len) {
+  (void)buf;
+  (void)len;
+}
+uint32_t iob_line_recv(void *buf, uint32_t len) {
+  (void)buf;
+  (void)len;
+  return 0;
+}
+uint32_t iob_line_pending() { return 0; }
+int iob_line_pty() { return 0; }
+
+// Create and map the shared-memory ring. It is initialized under a
+// temporary name, so the simulator never maps a partial ring, and carries the
+// run nonce, so it never keeps a stale one.
+static void shm_start(uint32_t nonce) {
+  int fd;
+
+  unlink(IOB_SHM_FILE);
+  fd = open(IOB_SHM_FILE ".tmp", O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0 || ftruncate(fd, sizeof(struct iob_shm))) {
+    printf("C: Error opening file %s\n", IOB_SHM_FILE);
     exit(1);
-  if (ack != req || mode != R || addr != address) {
-    printf("C: Error: These values should be equal: ack/req:%d==%d mode:%d==%d "
-           "addr:%d==%d\n",
-           ack, req, mode, R, addr, address);
+  }
+  shm = mmap(NULL, sizeof(struct iob_shm), PROT_READ | PROT_WRITE, MAP_SHARED,
+             fd, 0);
+  close(fd);
+  if (shm == MAP_FAILED) {
+    printf("C: Error mapping file %s\n", IOB_SHM_FILE);
     exit(1);
   }
-
-  // printf("C: Read %d: %08x from %08x\n", req, dat, address); // DEBUG
-  req++;
-  return dat;
+  shm->nonce = nonce;
+  __atomic_store_n(&shm->magic, IOB_SHM_MAGIC, __ATOMIC_RELEASE);
+  rename(IOB_SHM_FILE ".tmp", IOB_SHM_FILE);
 }
 
 void iob_start() {
+  if (getenv("IOB_SHM")) {
+    shm_start(strtoul(getenv("IOB_SHM"), NULL, 10));
+    return;
+  }
+
   // Open IPC files
   // Create named pipe for responses (no need for polling)
   int result = mkfifo(V2C_FILE, 0666);
@@ -117,6 +240,11 @@ void iob_start() {
 }
 
 void iob_finish() {
+  if (shm) {
+    shm_send(F, 0, 0, 0);
+    munmap(shm, sizeof(struct iob_shm));
+    return;
+  }
   fprintf(fpw, "%08x %08x %08x %08x %08x\n", req, F, 0, 0, 0);
   fflush(fpw);
   fclose(fpr);
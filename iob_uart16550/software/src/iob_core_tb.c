@@ -4,6 +4,7 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include "iob_tb_services.h"
 #include "iob_uart16550_csrs.h"
 
 #include <stdint.h>
@@ -16,6 +17,9 @@
 #define BYTE_1 (0x81)
 #define BYTE_2 (0x42)
 
+#define BENCH_BYTES (16)
+#define LINE_BYTES (1024)
+
 static inline void set_bit(uint8_t *v, int bit) { (*v) |= (1 << bit); }
 
 static inline void clr_bit(uint8_t *v, int bit) { (*v) &= ~(1 << bit); }
@@ -26,6 +30,7 @@ void uart16550_init(uint32_t base_address, uint16_t div) {
 
   // set base address
   iob_uart16550_csrs_init_baseaddr(base_address);
+  iob_uart16550_csrs_batch_begin();
 
   // set divisor latches
   iob_uart16550_csrs_set_dl1(div1);
@@ -39,6 +44,7 @@ void uart16550_init(uint32_t base_address, uint16_t div) {
   int_en_cfg |=
       (1 << IOB_UART16550_IE_THRE); // Transmitter Holding Register Empty
   iob_uart16550_csrs_set_ie(int_en_cfg);
+  iob_uart16550_csrs_batch_end();
 }
 
 static inline uint8_t uart_data_ready() {
@@ -88,6 +94,7 @@ int test_single_byte(uint32_t send_addr, uint32_t rcv_addr, uint8_t byte) {
   uint8_t rcv_data = iob_uart16550_csrs_get_rb();
   printf("Data out: %x\n", rcv_data);
   if (rcv_data != byte) {
+    iob_trace_trigger();
     printf("Error: expected %x but received %x\n", byte, rcv_data);
     failed = 1;
   }
@@ -121,6 +128,26 @@ int test_read_debug_regs(uint32_t base_address) {
 
   printf("\tDebug1: %x\n", iob_uart16550_csrs_get_db1());
   printf("\tDebug2: %x\n", iob_uart16550_csrs_get_db2());
+
+  // decoded debug registers must agree with the byte registers
+  struct iob_uart16550_snapshot s;
+  iob_uart16550_snapshot(&s);
+  printf("\tSnapshot: LS %x IE %x II %x LC %x MS %x FC %x MC %x "
+         "RF %d TF %d\n",
+         s.lsr, s.ier, s.iir, s.lcr, s.msr, s.fcr, s.mcr, s.rf_count,
+         s.tf_count);
+  if (s.lcr != iob_uart16550_csrs_get_lc()) {
+    iob_trace_trigger();
+    printf("Error: Snapshot LC %x mismatch\n", s.lcr);
+    return 1;
+  }
+  // test_write_regs() left the 14 byte trigger level: a DB2 that reads back
+  // 0 means the debug words lost their upper byte lanes
+  if (s.fcr != (IOB_UART16550_FC_TL_14 << IOB_UART16550_FC_TL)) {
+    iob_trace_trigger();
+    printf("Error: Snapshot FC %x mismatch\n", s.fcr);
+    return 1;
+  }
   return 0;
 }
 
@@ -148,6 +175,7 @@ int test_write_regs(uint32_t base_address) {
 void reset_uart(uint32_t base_address) {
   uint8_t cmd = 0;
   iob_uart16550_csrs_init_baseaddr(base_address);
+  iob_uart16550_csrs_batch_begin();
   // default interrupts
   iob_uart16550_csrs_set_ie(0x00);
   iob_uart16550_csrs_get_ii();
@@ -167,6 +195,7 @@ void reset_uart(uint32_t base_address) {
     iob_uart16550_csrs_get_rb();
   }
   iob_uart16550_csrs_get_ms();
+  iob_uart16550_csrs_batch_end();
 }
 
 int test_line_status(uint32_t test_base, uint32_t aux_base) {
@@ -187,6 +216,7 @@ int test_line_status(uint32_t test_base, uint32_t aux_base) {
   failed = (ticks >= timeout);
   fail_cnt += failed;
   if (failed) {
+    iob_trace_trigger();
     printf("Error: Data Ready timeout\n");
   }
   // bit 1: Overrun Error - FIFO DEPTH = 256
@@ -200,6 +230,7 @@ int test_line_status(uint32_t test_base, uint32_t aux_base) {
   failed = (uart_overrun_error() == 0);
   fail_cnt += failed;
   if (failed) {
+    iob_trace_trigger();
     printf("Error: Overrun Error not set\n");
   }
   reset_uart(test_base);
@@ -223,6 +254,7 @@ int test_line_status(uint32_t test_base, uint32_t aux_base) {
   failed = (uart_parity_error() == 0);
   fail_cnt += failed;
   if (failed) {
+    iob_trace_trigger();
     printf("Error: Parity Error not set\n");
   }
   reset_uart(test_base);
@@ -247,6 +279,7 @@ int test_line_status(uint32_t test_base, uint32_t aux_base) {
   failed = (uart_framing_error() == 0);
   fail_cnt += failed;
   if (failed) {
+    iob_trace_trigger();
     printf("Error: Framing Error not set\n");
   }
   reset_uart(test_base);
@@ -267,6 +300,7 @@ int test_line_status(uint32_t test_base, uint32_t aux_base) {
   failed = (uart_break_interrupt() == 0);
   fail_cnt += failed;
   if (failed) {
+    iob_trace_trigger();
     printf("Error: Break Interrupt not set\n");
   }
   reset_uart(test_base);
@@ -300,6 +334,130 @@ int test_rdata(uint32_t read_base, uint32_t write_base) {
   return failed;
 }
 
+// Count bus transactions per received byte, waiting for each byte by polling
+// LSR or by sleeping on the RDA interrupt (like uart16550_rxwait() built with
+// UART16550_WFI)
+int bench_rx_bus_cost(uint32_t send_base, uint32_t rcv_base, int wfi) {
+  int failed = 0;
+  unsigned int start, total = 0;
+  uint8_t rcv_data;
+  int i;
+
+  // RDA as soon as one byte is in
+  iob_uart16550_csrs_init_baseaddr(rcv_base);
+  iob_uart16550_csrs_set_fc(IOB_UART16550_FC_TL_1 << IOB_UART16550_FC_TL);
+  iob_uart16550_csrs_set_ie(wfi ? (1 << IOB_UART16550_IE_RDA) : 0);
+
+  for (i = 0; i < BENCH_BYTES; i++) {
+    iob_uart16550_csrs_init_baseaddr(send_base);
+    iob_uart16550_csrs_set_tr(i);
+    iob_uart16550_csrs_init_baseaddr(rcv_base);
+    start = iob_bus_transactions();
+    // the polling loop is also the fallback without interrupt lines
+    if (wfi)
+      iob_wait_irq(1 << (rcv_base >> UART16550_ADDR_W));
+    while (uart_data_ready() == 0)
+      ;
+    rcv_data = iob_uart16550_csrs_get_rb();
+    total += iob_bus_transactions() - start;
+    if (rcv_data != i) {
+      iob_trace_trigger();
+      printf("Error: expected %x but received %x\n", i, rcv_data);
+      failed = 1;
+    }
+  }
+  printf("RX bus transactions per byte (%s): %u.%02u\n", wfi ? "wfi" : "poll",
+         total / BENCH_BYTES, (total % BENCH_BYTES) * 100 / BENCH_BYTES);
+
+  reset_uart(rcv_base);
+  return failed;
+}
+
+// Stream LINE_BYTES into the receiver at line rate with the RS232 line
+// model, draining the RX FIFO by its fill level, and report the FIFO
+// behaviour. Then send BENCH_BYTES back to the line model.
+int bench_line(uint32_t base, uint16_t div) {
+  static uint8_t data[LINE_BYTES];
+  struct iob_uart16550_snapshot s;
+  unsigned int i, n, rcvd = 0, max_level = 0, overruns = 0, idle = 0;
+  int failed = 0;
+
+  // 8N1, no gap between characters
+  if (!iob_line_config(16 * div, 0x03, 0))
+    return 0; // no line model on this transport
+
+  for (i = 0; i < LINE_BYTES; i++)
+    data[i] = i * 7 + 1;
+  iob_uart16550_csrs_init_baseaddr(base);
+  iob_line_send(data, LINE_BYTES);
+  while (rcvd < LINE_BYTES && idle < 1000) {
+    if (iob_uart16550_csrs_get_ls() & (1 << IOB_UART16550_LS_OE))
+      overruns++;
+    iob_uart16550_snapshot(&s);
+    n = s.rf_count;
+    if (n > max_level)
+      max_level = n;
+    idle = (n || iob_line_pending()) ? 0 : idle + 1;
+    for (; n && rcvd < LINE_BYTES; n--, rcvd++) {
+      if (iob_uart16550_csrs_get_rb() != data[rcvd] && !failed) {
+        iob_trace_trigger();
+        printf("Error: line RX byte %u mismatch\n", rcvd);
+        failed = 1;
+      }
+    }
+  }
+  printf("Line RX: %u of %u bytes, max RX FIFO level %u, overruns %u\n", rcvd,
+         LINE_BYTES, max_level, overruns);
+  if (rcvd < LINE_BYTES) {
+    iob_trace_trigger();
+    printf("Error: line RX timeout\n");
+    failed = 1;
+  }
+
+  for (i = 0; i < BENCH_BYTES; i++)
+    iob_uart16550_csrs_set_tr(data[i]);
+  while (uart_transmitter_empty() == 0)
+    ;
+  n = iob_line_recv(data + LINE_BYTES - BENCH_BYTES, BENCH_BYTES);
+  for (i = 0; i < BENCH_BYTES; i++) {
+    if (i >= n || data[LINE_BYTES - BENCH_BYTES + i] != data[i]) {
+      iob_trace_trigger();
+      printf("Error: line TX byte %u mismatch\n", i);
+      failed = 1;
+      break;
+    }
+  }
+
+  iob_line_config(0, 0, 0);
+  reset_uart(base);
+  return failed;
+}
+
+// Serve the PTY bridged to the line model (+pty with Verilator): echo what
+// the receiver gets back to the line until EOT (Ctrl-D) arrives. Any serial
+// tool can open the PTY as a port, 8N1.
+int serve_pty(uint32_t base, uint16_t div) {
+  uint8_t c;
+
+  if (!iob_line_pty())
+    return 0; // no PTY on this transport
+  iob_line_config(16 * div, 0x03, 0);
+  iob_uart16550_csrs_init_baseaddr(base);
+  printf("Echoing the PTY until EOT\n");
+  do {
+    while (uart_data_ready() == 0)
+      ;
+    c = iob_uart16550_csrs_get_rb();
+    iob_uart16550_csrs_set_tr(c);
+  } while (c != 0x04);
+  while (uart_transmitter_empty() == 0)
+    ;
+
+  // the line model stays up, for the harness to flush the echoed EOT
+  reset_uart(base);
+  return 0;
+}
+
 int iob_core_tb() {
 
   int failed = 0;
@@ -310,11 +468,19 @@ int iob_core_tb() {
   // print the reset message
   printf("Reset complete\n");
 
-  // init UART0
-  uart16550_init(UART0_BASE, 3);
+  // submit batched CSR accesses in one transport round trip
+  iob_uart16550_csrs_set_batch_fn(iob_batch);
+
+  // init the UARTs, unless resumed from a checkpoint taken after it
+  if (!iob_restore()) {
+    // init UART0
+    uart16550_init(UART0_BASE, 3);
 
-  // init UART1
-  uart16550_init(UART1_BASE, 3);
+    // init UART1
+    uart16550_init(UART1_BASE, 3);
+
+    iob_checkpoint();
+  }
 
   // Send test bytes
   failed += test_single_byte(UART0_BASE, UART1_BASE, BYTE_1);
@@ -336,6 +502,12 @@ int iob_core_tb() {
   failed += test_rdata(UART0_BASE, UART1_BASE);
   failed += test_rdata(UART1_BASE, UART0_BASE);
 
+  failed += bench_rx_bus_cost(UART0_BASE, UART1_BASE, 0);
+  failed += bench_rx_bus_cost(UART0_BASE, UART1_BASE, 1);
+
+  failed += bench_line(UART1_BASE, 3);
+  failed += serve_pty(UART1_BASE, 3);
+
   printf("UART16550 test complete.\n");
   return failed;
 }
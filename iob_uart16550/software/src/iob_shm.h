@@ -0,0 +1,59 @@
+/*
+ * SPDX-FileCopyrightText: 2025 IObundle
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/** @file iob_shm.h
+ *  @brief Shared-memory ring between the C testbench and the simulator
+ *
+ * Binary alternative to the c2v.txt/v2c.txt text pipes. The C testbench
+ * creates IOB_SHM_FILE, maps it and posts requests in ring[head % RING],
+ * then advances head. The simulator side (the iob_shm_vpi shim) serves them
+ * in order, writes read data back into the same slot and advances tail.
+ * Both sides poll the counters: there are no system calls per access.
+ *
+ * IOB_SHM, in the environment of both sides, holds a per-run nonce: the
+ * simulator only serves a ring that carries it, so a ring file left over by
+ * an earlier run is never used.
+ */
+
+#ifndef H_IOB_SHM_H
+#define H_IOB_SHM_H
+
+#include <stdint.h>
+
+/** @brief Ring file, in the simulation directory */
+#define IOB_SHM_FILE "iob_shm.bin"
+
+/** @brief Set once the C testbench has initialized the ring */
+#define IOB_SHM_MAGIC 0x494f4253
+
+/** @brief Ring slots; larger than a CSR batch */
+#define IOB_SHM_RING 256
+
+/** @brief Request modes, as in the text protocol */
+#define IOB_SHM_R 0
+#define IOB_SHM_W 1
+#define IOB_SHM_F 2
+
+/** @brief Ring slot: a request, and the read data once served */
+struct iob_shm_req {
+  uint32_t mode;
+  uint32_t addr;
+  uint32_t data_w;
+  uint32_t data;
+};
+
+/** @brief Ring file layout; head and tail on separate cache lines */
+struct iob_shm {
+  uint32_t magic;
+  uint32_t nonce; ///< IOB_SHM of the run that created the ring
+  uint32_t head;  ///< requests posted, written by the C testbench
+  uint32_t pad0[13];
+  uint32_t tail; ///< requests served, written by the simulator
+  uint32_t pad1[15];
+  struct iob_shm_req ring[IOB_SHM_RING];
+};
+
+#endif // H_IOB_SHM_H
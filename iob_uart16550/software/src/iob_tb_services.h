@@ -0,0 +1,63 @@
+/*
+ * SPDX-FileCopyrightText: 2025 IObundle
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/** @file iob_tb_services.h
+ *  @brief Services of the simulation harness to the core testbench
+ *
+ * Used by iob_core_tb.c and defined by each harness: iob_c_tb.c with the
+ * Verilog testbench, iob_vlt_tb.cpp with Verilator. Services a harness cannot
+ * provide are stubs that report them as unavailable.
+ */
+
+#ifndef H_IOB_TB_SERVICES_H
+#define H_IOB_TB_SERVICES_H
+
+#include "iob_uart16550_csrs.h"
+
+#include <stdint.h>
+
+/** @brief Number of bus transactions issued so far. */
+uint32_t iob_bus_transactions();
+
+/** @brief Run without bus traffic until an interrupt in mask is asserted.
+ * @return 1 once asserted, 0 on timeout or without interrupt lines.
+ */
+int iob_wait_irq(uint32_t mask);
+
+/** @brief Issue n accesses in one round trip; read data is stored in ops. */
+void iob_batch(struct iob_uart16550_csrs_op *ops, uint32_t n);
+
+/** @brief Report a failure, to start the trace window around it. */
+void iob_trace_trigger();
+
+/** @brief Save the simulation state here, when a checkpoint was asked for. */
+void iob_checkpoint();
+
+/** @brief Whether the state was restored from a checkpoint. */
+int iob_restore();
+
+/** @brief Configure the RS232 line model.
+ * @return 1 if the harness has a line model, 0 otherwise.
+ */
+int iob_line_config(uint32_t cycles_per_bit, uint32_t lcr, uint32_t gap);
+
+/** @brief Send len bytes to the core's RX pin through the line model. */
+void iob_line_send(const void *buf, uint32_t len);
+
+/** @brief Take up to len bytes sent on the core's TX pin.
+ * @return Number of bytes taken.
+ */
+uint32_t iob_line_recv(void *buf, uint32_t len);
+
+/** @brief Bytes still to be sent by the line model. */
+uint32_t iob_line_pending();
+
+/** @brief Bridge the line model to a PTY, if one was opened.
+ * @return 1 if bridged.
+ */
+int iob_line_pty();
+
+#endif // H_IOB_TB_SERVICES_H
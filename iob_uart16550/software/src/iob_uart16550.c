@@ -6,125 +6,846 @@
 
 #include "iob_uart16550.h"
 #include <stdint.h>
+#include <string.h>
 
-static int base;
+#ifdef UART16550_IOB_BUS
+#include "iob_uart16550_csrs.h"
+#endif
+
+#define RING_MASK (UART16550_RING_SIZE - 1)
+
+// Console capabilities returned by uart16550_probe()
+#define PROBE_FRAMED 0x1
+#define PROBE_LZ 0x2
+#define PROBE_BAUD 0x4
+#define PROBE_STREAM 0x8
+#define PROBE_STATS 0x10
+
+// Register access: loads and stores at the instance base, or iob_read() and
+// iob_write() with UART16550_IOB_BUS
+#ifdef UART16550_IOB_BUS
+#define UART16550_RD8(dev, n) ((uint8_t)iob_read((dev)->base + (n), 8))
+#define UART16550_RD32(dev, n) iob_read((dev)->base + (n), 32)
+#define UART16550_WR8(dev, n, v) iob_write((dev)->base + (n), 8, (uint8_t)(v))
+#else
+#define UART16550_RD8(dev, n) (*((volatile uint8_t *)((dev)->base + (n))))
+#define UART16550_RD32(dev, n) (*((volatile uint32_t *)((dev)->base + (n))))
+#define UART16550_WR8(dev, n, v)                                               \
+  (*((volatile uint8_t *)((dev)->base + (n))) = (v))
+#endif
+
+#ifdef UART16550_STATS
+#ifndef UART16550_STATS_TIME
+#define UART16550_STATS_TIME(dev) ((dev)->stats.lsr_reads)
+#endif
+#define STATS_ADD(dev, field, n) ((dev)->stats.field += (n))
+#define STATS_WAIT_START(dev) uint32_t stats_t0 = UART16550_STATS_TIME(dev)
+#define STATS_WAIT_END(dev, field)                                             \
+  ((dev)->stats.field += UART16550_STATS_TIME(dev) - stats_t0)
+#else
+#define STATS_ADD(dev, field, n)
+#define STATS_WAIT_START(dev)
+#define STATS_WAIT_END(dev, field)
+#endif
+
+// Instance used by the functions without a handle argument
+static struct uart16550_dev uart16550_default;
+
+static void uart16550_set_irq(struct uart16550_dev *dev);
+
+#ifdef UART16550_WFI
+#ifndef UART16550_WFI_INSN
+#define UART16550_WFI_INSN() __asm__ volatile("wfi")
+#endif
+
+// Enable only the interrupt sources in ier for the core to sleep on. Reading
+// IIR drops a THRE indication left over from an earlier drain.
+static void uart16550_wfi_arm(struct uart16550_dev *dev, uint8_t ier) {
+  UART16550_WR8(dev, 1, ier);
+  (void)UART16550_RD8(dev, 2);
+}
+#endif
+
+// LINE STATUS
+// Read LSR, counting the error conditions that reading it clears
+static uint8_t uart16550_lsr(struct uart16550_dev *dev) {
+  uint8_t lsr = UART16550_RD8(dev, 5);
+#ifdef UART16550_STATS
+  dev->stats.lsr_reads++;
+  if (lsr & 0x1E) {
+    dev->stats.overrun += (lsr >> 1) & 0x01;
+    dev->stats.parity += (lsr >> 2) & 0x01;
+    dev->stats.framing += (lsr >> 3) & 0x01;
+    dev->stats.brk += (lsr >> 4) & 0x01;
+  }
+#endif
+  return lsr;
+}
 
 // TX FUNCTIONS
-void uart16550_txwait() {
-  while (!uart16550_txready())
+// Wait for the TX FIFO to drain
+static void uart16550_txfifo_wait(struct uart16550_dev *dev) {
+  if (uart16550_dev_txfifo_empty(dev))
+    return;
+  STATS_WAIT_START(dev);
+#ifdef UART16550_WFI
+  // THRE
+  uart16550_wfi_arm(dev, 0x02);
+  while (!uart16550_dev_txfifo_empty(dev))
+    UART16550_WFI_INSN();
+  uart16550_set_irq(dev);
+#else
+  while (!uart16550_dev_txfifo_empty(dev))
     ;
+#endif
+  STATS_WAIT_END(dev, tx_wait);
 }
 
-char uart16550_txready() {
+void uart16550_dev_txwait(struct uart16550_dev *dev) {
+  // the shift register takes at most one more character after the FIFO
+  uart16550_txfifo_wait(dev);
+  STATS_WAIT_START(dev);
+  while (!uart16550_dev_txready(dev))
+    ;
+  STATS_WAIT_END(dev, tx_wait);
+}
+
+char uart16550_dev_txready(struct uart16550_dev *dev) {
   uint8_t status = 0;
-  status = *((volatile uint8_t *)(base + 5));
+  status = uart16550_lsr(dev);
   return (status & (0x01 << 6));
 }
 
-void uart16550_putc(char c) {
-  uart16550_txwait();
-  *((volatile uint8_t *)(base)) = c;
+char uart16550_dev_txfifo_empty(struct uart16550_dev *dev) {
+  uint8_t status = 0;
+  status = uart16550_lsr(dev);
+  return (status & (0x01 << 5));
+}
+
+// Push up to a TX FIFO worth of the TX ring; the TX FIFO must be empty
+static void uart16550_tx_push(struct uart16550_dev *dev) {
+  struct uart16550_ring *ring = &dev->tx_ring;
+  uint32_t tail = ring->tail;
+  size_t n = ring->head - tail;
+
+  if (n > UART16550_FIFO_DEPTH)
+    n = UART16550_FIFO_DEPTH;
+  STATS_ADD(dev, tx_bytes, n);
+  while (n--)
+    UART16550_WR8(dev, 0, ring->data[tail++ & RING_MASK]);
+  ring->tail = tail;
+  // the blocking TX credit no longer holds: re-read the level before use
+  dev->tx_room = 0;
+}
+
+// Send the queued ring output ahead of a blocking send. THRE is masked first
+// so the ISR cannot push the same bytes; the ISR need not be hooked up or able
+// to run. uart16550_putc_nb() enables THRE again.
+static void uart16550_tx_drain(struct uart16550_dev *dev) {
+  if (dev->tx_ring.head == dev->tx_ring.tail)
+    return;
+  dev->tx_irq_en = 0;
+  uart16550_set_irq(dev);
+  while (dev->tx_ring.head != dev->tx_ring.tail) {
+    uart16550_txfifo_wait(dev);
+    uart16550_tx_push(dev);
+  }
+}
+
+static void uart16550_fifo_write(struct uart16550_dev *dev, const void *buf,
+                                 size_t len) {
+  const uint8_t *p = (const uint8_t *)buf;
+  size_t n;
+
+  // queued ring output goes first
+  uart16550_tx_drain(dev);
+  STATS_ADD(dev, tx_bytes, len);
+  while (len) {
+    // once the TX FIFO is drained a whole FIFO-full can be pushed
+    if (dev->tx_room == 0) {
+      uart16550_txfifo_wait(dev);
+      dev->tx_room = UART16550_FIFO_DEPTH;
+    }
+    n = (len < dev->tx_room) ? len : dev->tx_room;
+    dev->tx_room -= n;
+    len -= n;
+    while (n--)
+      UART16550_WR8(dev, 0, *p++);
+  }
+}
+
+// TX FIFO slots known to be free; reads the TX FIFO level when none are left
+static uint32_t uart16550_txroom(struct uart16550_dev *dev) {
+  uint32_t db2;
+
+  if (dev->tx_room == 0) {
+    db2 = UART16550_RD32(dev, 12);
+    dev->tx_room = UART16550_FIFO_DEPTH - ((db2 >> 3) & 0x1FF);
+  }
+  return dev->tx_room;
+}
+
+// Push as much buffered output as the TX FIFO takes without waiting
+int uart16550_dev_flush_nb(struct uart16550_dev *dev) {
+  struct uart16550_obuf *ob = &dev->obuf;
+  uint32_t n;
+
+  if (ob->head == ob->tail)
+    return 0;
+  // queued ring output goes first; draining it here would wait
+  if (dev->tx_ring.head != dev->tx_ring.tail)
+    return ob->head - ob->tail;
+  n = uart16550_txroom(dev);
+  if (n > (uint32_t)(ob->head - ob->tail))
+    n = ob->head - ob->tail;
+  uart16550_fifo_write(dev, ob->data + ob->tail, n);
+  ob->tail += n;
+  if (ob->tail == ob->head)
+    ob->head = ob->tail = 0;
+  return ob->head - ob->tail;
+}
+
+void uart16550_dev_flush(struct uart16550_dev *dev) {
+  struct uart16550_obuf *ob = &dev->obuf;
+
+  uart16550_fifo_write(dev, ob->data + ob->tail, ob->head - ob->tail);
+  ob->head = ob->tail = 0;
+}
+
+void uart16550_dev_bputc(struct uart16550_dev *dev, char c) {
+  struct uart16550_obuf *ob = &dev->obuf;
+
+  if (ob->head == UART16550_OBUF_SIZE) {
+    // make room: drain what fits, compact, and wait only if the FIFO is full
+    uart16550_dev_flush_nb(dev);
+    if (ob->tail) {
+      memmove(ob->data, ob->data + ob->tail, ob->head - ob->tail);
+      ob->head -= ob->tail;
+      ob->tail = 0;
+    }
+    if (ob->head == UART16550_OBUF_SIZE)
+      uart16550_dev_flush(dev);
+  }
+  ob->data[ob->head++] = (uint8_t)c;
+  if (c == '\n')
+    uart16550_dev_flush_nb(dev);
+}
+
+void uart16550_dev_write(struct uart16550_dev *dev, const void *buf,
+                         size_t len) {
+  // buffered output goes out first to keep the byte order
+  if (dev->obuf.head != dev->obuf.tail)
+    uart16550_dev_flush(dev);
+  uart16550_fifo_write(dev, buf, len);
+}
+
+void uart16550_dev_putc(struct uart16550_dev *dev, char c) {
+  uart16550_dev_write(dev, &c, 1);
 }
 
 // RX FUNCTIONS
-void uart16550_rxwait() {
-  while (!uart16550_rxready())
-    ;
+void uart16550_dev_rxwait(struct uart16550_dev *dev) {
+  if (uart16550_dev_rxready(dev))
+    return;
+  STATS_WAIT_START(dev);
+  // a prompt still in the output buffer must not wait for a newline
+#ifdef UART16550_WFI
+  // RDA and character timeout, plus THRE while buffered output waits for room
+  do {
+    uart16550_wfi_arm(dev, uart16550_dev_flush_nb(dev) ? 0x03 : 0x01);
+    if (!uart16550_dev_rxready(dev))
+      UART16550_WFI_INSN();
+  } while (!uart16550_dev_rxready(dev));
+  uart16550_set_irq(dev);
+#else
+  do
+    uart16550_dev_flush_nb(dev);
+  while (!uart16550_dev_rxready(dev));
+#endif
+  STATS_WAIT_END(dev, rx_wait);
 }
 
-char uart16550_rxready() {
+char uart16550_dev_rxready(struct uart16550_dev *dev) {
   uint8_t status = 0;
-  status = *((volatile uint8_t *)(base + 5));
+  status = uart16550_lsr(dev);
   return (status & (0x01));
 }
 
-char uart16550_getc() {
+char uart16550_dev_getc(struct uart16550_dev *dev) {
   uint8_t rvalue;
-  uart16550_rxwait();
-  rvalue = *((volatile uint8_t *)(base));
+  uart16550_dev_rxwait(dev);
+  rvalue = UART16550_RD8(dev, 0);
+  STATS_ADD(dev, rx_bytes, 1);
   return rvalue;
 }
 
-// UART basic functions
-void uart16550_init(int base_address, uint16_t div) {
-  // capture base address for good
-  base = base_address;
+// Clock cycles taken by chars characters: 10 bits of 16 divisor periods each
+static uint32_t uart16550_char_cycles(uint16_t div, uint32_t chars) {
+  uint32_t per_char = 160 * (uint32_t)(div ? div : 1);
 
-  // Set the Line Control Register to the desired line control parameters.
-  // Set bit 7 to ‘1’ to allow access to the Divisor Latches.
-  uint8_t lcr = 0;
-  lcr = *((volatile uint8_t *)(base + 3));
-  lcr = (lcr | 0x80);
-  *((volatile uint8_t *)(base + 3)) = lcr;
+  return chars > UINT32_MAX / per_char ? UINT32_MAX : chars * per_char;
+}
+
+// Get char, giving up after the given clock cycles without one; returns -1 on
+// timeout. Without UART16550_CYCLES() each LSR read counts as one cycle, so the
+// wait is never shorter than asked for.
+static int uart16550_getc_timeout(struct uart16550_dev *dev, uint32_t cycles) {
+#ifdef UART16550_CYCLES
+  uint32_t t0 = UART16550_CYCLES();
+
+  while (!uart16550_dev_rxready(dev))
+    if ((uint32_t)(UART16550_CYCLES() - t0) > cycles)
+      return -1;
+#else
+  while (!uart16550_dev_rxready(dev))
+    if (!cycles--)
+      return -1;
+#endif
+  return (uint8_t)uart16550_dev_getc(dev);
+}
+
+size_t uart16550_dev_rxcount(struct uart16550_dev *dev) {
+  // debug register 2: {fcr, mcr, rf_count, rstate, tf_count, tstate}
+  uint32_t db2 = 0;
+  db2 = UART16550_RD32(dev, 12);
+  return (db2 >> 16) & 0x1FF;
+}
+
+void uart16550_dev_read(struct uart16550_dev *dev, void *buf, size_t len) {
+  uint8_t *p = (uint8_t *)buf;
+  size_t n;
+
+  STATS_ADD(dev, rx_bytes, len);
+  while (len) {
+    // every byte counted in the RX FIFO can be popped without polling LSR
+    n = uart16550_dev_rxcount(dev);
+    if (n > len)
+      n = len;
+    len -= n;
+    while (n--)
+      *p++ = UART16550_RD8(dev, 0);
+  }
+}
+
+// INTERRUPT DRIVEN FUNCTIONS
+static void uart16550_set_irq(struct uart16550_dev *dev) {
+  // Recomputed from the flags on every update: a stale write from thread
+  // context only re-raises an interrupt, which the ISR then masks again.
+  UART16550_WR8(dev, 1, (dev->tx_irq_en << 1) | dev->rx_irq_en);
+}
+
+static void uart16550_isr_rx(struct uart16550_dev *dev) {
+  struct uart16550_ring *ring = &dev->rx_ring;
+  size_t n = uart16550_dev_rxcount(dev);
+  uint32_t head = ring->head;
+  size_t space = UART16550_RING_SIZE - (head - ring->tail);
+
+  if (n > space) {
+    // RX ring full: leave the rest in the RX FIFO until the consumer catches up
+    n = space;
+    dev->rx_irq_en = 0;
+    uart16550_set_irq(dev);
+  }
+  STATS_ADD(dev, rx_bytes, n);
+  while (n--)
+    ring->data[head++ & RING_MASK] = UART16550_RD8(dev, 0);
+  ring->head = head;
+}
+
+static void uart16550_isr_tx(struct uart16550_dev *dev) {
+  if (dev->tx_ring.head == dev->tx_ring.tail) {
+    // nothing left to send: stop THRE interrupts until new data is queued
+    dev->tx_irq_en = 0;
+    uart16550_set_irq(dev);
+    return;
+  }
+  // THRE means the TX FIFO is empty
+  uart16550_tx_push(dev);
+}
+
+void uart16550_dev_isr(struct uart16550_dev *dev) {
+  uint8_t iir;
+
+  // IIR bit 0 is cleared while an interrupt is pending
+  while (!((iir = UART16550_RD8(dev, 2)) & 0x01)) {
+    switch ((iir >> 1) & 0x07) {
+    case 0x3: // RLS: reading LSR clears the error condition
+      uart16550_lsr(dev);
+      break;
+    case 0x2: // RDA
+    case 0x6: // TI
+      uart16550_isr_rx(dev);
+      break;
+    case 0x1: // THRE
+      uart16550_isr_tx(dev);
+      break;
+    default: // MS: reading MSR clears it
+      (void)UART16550_RD8(dev, 6);
+      break;
+    }
+  }
+}
+
+int uart16550_dev_putc_nb(struct uart16550_dev *dev, char c) {
+  struct uart16550_ring *ring = &dev->tx_ring;
+  uint32_t head = ring->head;
+
+  if (head - ring->tail == UART16550_RING_SIZE)
+    return 0;
+  ring->data[head & RING_MASK] = c;
+  ring->head = head + 1;
+  // enabling THRE while the TX FIFO is empty raises the interrupt at once
+  if (!dev->tx_irq_en) {
+    dev->tx_irq_en = 1;
+    uart16550_set_irq(dev);
+  }
+  return 1;
+}
+
+int uart16550_dev_getc_nb(struct uart16550_dev *dev, char *c) {
+  struct uart16550_ring *ring = &dev->rx_ring;
+  uint32_t tail = ring->tail;
+
+  if (ring->head == tail)
+    return 0;
+  *c = ring->data[tail & RING_MASK];
+  ring->tail = tail + 1;
+  // space was freed: resume draining the RX FIFO
+  if (!dev->rx_irq_en) {
+    dev->rx_irq_en = 1;
+    uart16550_set_irq(dev);
+  }
+  return 1;
+}
+
+// UART basic functions
+// Program the divisor latches
+static void uart16550_set_div(struct uart16550_dev *dev, uint16_t div) {
+  // Set bit 7 of LCR to ‘1’ to allow access to the Divisor Latches.
+  UART16550_WR8(dev, 3, dev->lcr | 0x80);
 
   // Set the Divisor Latches, MSB first, LSB next.
   uint8_t *dl = (uint8_t *)&div;
-  *((volatile uint8_t *)(base + 1)) = *(dl + 1);
-  *((volatile uint8_t *)(base)) = *(dl);
+  UART16550_WR8(dev, 1, *(dl + 1));
+  UART16550_WR8(dev, 0, *(dl));
 
   // Set bit 7 of LCR to ‘0’ to disable access to Divisor Latches.
   // At this time the transmission engine starts working and data can be sent
   // and received.
-  lcr = (lcr & 0x7F);
-  *((volatile uint8_t *)(base + 3)) = lcr;
+  UART16550_WR8(dev, 3, dev->lcr);
+  dev->div = div;
+}
+
+void uart16550_dev_init(struct uart16550_dev *dev, int base_address,
+                        uint16_t div) {
+  // capture base address for good
+  dev->base = base_address;
+  dev->tx_room = 0;
+  dev->obuf.head = dev->obuf.tail = 0;
+  dev->rx_left = 0;
+#ifdef UART16550_STATS
+  memset(&dev->stats, 0, sizeof(dev->stats));
+#endif
+
+  // Set the Line Control Register to the desired line control parameters.
+  dev->lcr = UART16550_RD8(dev, 3) & 0x7F;
+  uart16550_set_div(dev, div);
 
   // Set the FIFO trigger level. Generally, higher trigger level values produce
   // less interrupt to the system, so setting it to 14 bytes is recommended if
   // the system responds fast enough.
-  *((volatile uint8_t *)(base + 2)) = 0xC0;
+  UART16550_WR8(dev, 2, 0xC0);
 
   // Enable desired interrupts by setting appropriate bits in the Interrupt
   // Enable register.
-  *((volatile uint8_t *)(base + 1)) = 0x03;
-}
-
-// Change UART base
-int uart16550_base(int base_address) {
-  int previous = base;
-  base = base_address;
-  return previous;
+  dev->tx_ring.head = dev->tx_ring.tail = 0;
+  dev->rx_ring.head = dev->rx_ring.tail = 0;
+  dev->rx_irq_en = 1;
+  dev->tx_irq_en = 1;
+  uart16550_set_irq(dev);
 }
 
-void uart16550_finish() {
-  uart16550_putc(EOT);
-  uart16550_txwait();
+void uart16550_dev_finish(struct uart16550_dev *dev) {
+  uart16550_dev_putc(dev, EOT);
+  uart16550_dev_txwait(dev);
 }
 
 // Print string, excluding end of string (0)
-void uart16550_puts(const char *s) {
-  while (*s)
-    uart16550_putc(*s++);
+void uart16550_dev_puts(struct uart16550_dev *dev, const char *s) {
+  uart16550_dev_write(dev, s, strlen(s));
 }
 
 // Sends the name of the file to use, including end of string (0)
-void uart16550_sendstr(char *name) {
-  int i = 0;
+static void uart16550_dev_sendstr(struct uart16550_dev *dev, char *name) {
+  uart16550_dev_write(dev, name, strlen(name) + 1);
+}
+
+// FRAMED FILE TRANSFER
+static uint32_t uart16550_crc32(uint32_t crc, const uint8_t *p, size_t len) {
+  // reflected CRC32 (0xEDB88320), one nibble at a time
+  static const uint32_t tab[16] = {
+      0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
+      0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+      0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c};
+
+  while (len--) {
+    crc ^= *p++;
+    crc = (crc >> 4) ^ tab[crc & 0x0F];
+    crc = (crc >> 4) ^ tab[crc & 0x0F];
+  }
+  return crc;
+}
+
+static void uart16550_put_le32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t uart16550_get_le32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Payload length of block idx of a file with size bytes
+static uint32_t uart16550_frame_len(uint32_t size, uint32_t idx) {
+  uint32_t left = size - idx * UART16550_FRAME_SIZE;
+  return (left < UART16550_FRAME_SIZE) ? left : UART16550_FRAME_SIZE;
+}
+
+// Send SOH, index, length, payload and CRC32 of index, length and payload
+static void uart16550_frame_send(struct uart16550_dev *dev, uint32_t idx,
+                                 const uint8_t *data, uint32_t len) {
+  uint8_t hdr[7];
+  uint8_t crc_le[4];
+  uint32_t crc;
+
+  hdr[0] = SOH;
+  uart16550_put_le32(hdr + 1, idx);
+  hdr[5] = (uint8_t)len;
+  hdr[6] = (uint8_t)(len >> 8);
+  crc = uart16550_crc32(0xFFFFFFFF, hdr + 1, 6);
+  crc = uart16550_crc32(crc, data, len) ^ 0xFFFFFFFF;
+  uart16550_put_le32(crc_le, crc);
+
+  uart16550_dev_write(dev, hdr, 7);
+  uart16550_dev_write(dev, data, len);
+  uart16550_dev_write(dev, crc_le, 4);
+}
+
+// Send ACK or NAK, index and CRC32 of both
+static void uart16550_ctrl_send(struct uart16550_dev *dev, uint8_t ctrl,
+                                uint32_t idx) {
+  uint8_t f[9];
+
+  f[0] = ctrl;
+  uart16550_put_le32(f + 1, idx);
+  uart16550_put_le32(f + 5, uart16550_crc32(0xFFFFFFFF, f, 5) ^ 0xFFFFFFFF);
+  uart16550_dev_write(dev, f, 9);
+}
+
+// Receive ACK or NAK frame; returns 0 if it is corrupted
+static int uart16550_ctrl_recv(struct uart16550_dev *dev, uint8_t *ctrl,
+                               uint32_t *idx) {
+  uint8_t f[9];
+
+  // resynchronize on the control byte
   do
-    uart16550_putc(name[i]);
-  while (name[i++]);
+    uart16550_dev_read(dev, f, 1);
+  while (f[0] != ACK && f[0] != NAK);
+  uart16550_dev_read(dev, f + 1, 8);
+  if ((uart16550_crc32(0xFFFFFFFF, f, 5) ^ 0xFFFFFFFF) !=
+      uart16550_get_le32(f + 5))
+    return 0;
+  *ctrl = f[0];
+  *idx = uart16550_get_le32(f + 1);
+  return 1;
+}
+
+// Ask the console for its protocol extensions: a framed console answers SYN,
+// then FRXZ if it compresses uploads, BRC if it can change its baud rate,
+// FRXS if it paces uploads by chunk and STATS if it prints statistics, before
+// the ACK to ENQ. A legacy console prints SYN and only sends the ACK.
+static int uart16550_probe(struct uart16550_dev *dev) {
+  int caps = 0;
+  char c;
+
+  uart16550_dev_putc(dev, SYN);
+  uart16550_dev_putc(dev, ENQ);
+  while ((c = uart16550_dev_getc(dev)) != ACK)
+    if (c == SYN)
+      caps |= PROBE_FRAMED;
+    else if (c == FRXZ)
+      caps |= PROBE_LZ;
+    else if (c == BRC)
+      caps |= PROBE_BAUD;
+    else if (c == FRXS)
+      caps |= PROBE_STREAM;
+    else if (c == STATS)
+      caps |= PROBE_STATS;
+  return caps;
+}
+
+// Add the extra length bytes that follow a 15 in a token nibble; clears ok
+// if the input ends first
+static uint32_t uart16550_lz_len(struct uart16550_dev *dev, uint32_t len,
+                                 uint32_t *in, uint32_t csize, int *ok) {
+  uint8_t b;
+
+  if (len == 15)
+    do {
+      if (*in == csize) {
+        *ok = 0;
+        break;
+      }
+      b = uart16550_dev_getc(dev);
+      (*in)++;
+      len += b;
+    } while (b == 255);
+  return len;
+}
+
+// Decompress csize bytes of input into size bytes of dst as they arrive.
+// Literals are read straight into dst. Reads exactly csize bytes, even of an
+// inconsistent stream, and never writes past size; returns 0 if the stream
+// is inconsistent.
+static int uart16550_lz_decode(struct uart16550_dev *dev, uint8_t *dst,
+                               uint32_t size, uint32_t csize) {
+  uint32_t in = 0, out = 0;
+  uint32_t len, off, n;
+  uint8_t tok, b;
+  int ok = 1;
+
+  while (in < csize) {
+    tok = uart16550_dev_getc(dev);
+    in++;
+
+    // literals
+    len = uart16550_lz_len(dev, tok >> 4, &in, csize, &ok);
+    if (len > csize - in) {
+      len = csize - in;
+      ok = 0;
+    }
+    n = (len < size - out) ? len : size - out;
+    uart16550_dev_read(dev, dst + out, n);
+    for (in += len, out += n; n < len; n++)
+      uart16550_dev_getc(dev);
+    if (in == csize)
+      break;
+
+    // match
+    if (csize - in < 2) {
+      uart16550_dev_getc(dev);
+      ok = 0;
+      break;
+    }
+    off = (uint8_t)uart16550_dev_getc(dev);
+    off |= (uint8_t)uart16550_dev_getc(dev) << 8;
+    in += 2;
+    len = uart16550_lz_len(dev, tok & 0x0F, &in, csize, &ok) + 4;
+    if (off == 0 || off > out) {
+      ok = 0;
+      continue;
+    }
+    while (len-- && out < size) {
+      b = dst[out - off];
+      dst[out++] = b;
+    }
+  }
+
+  return ok && out == size;
+}
+
+// Receive the compressed file, resending the ACK until the CRC32 matches
+static int uart16550_recvfile_lz(struct uart16550_dev *dev, char *mem) {
+  uint32_t idle = uart16550_char_cycles(dev->div, UART16550_LZ_TIMEOUT);
+  uint8_t hdr[8];
+  uint8_t crc_le[4];
+  uint32_t size, csize, i;
+  int ok, c;
+
+  uart16550_dev_read(dev, hdr, 8);
+  size = uart16550_get_le32(hdr);
+  csize = uart16550_get_le32(hdr + 4);
+
+  for (;;) {
+    uart16550_dev_putc(dev, ACK);
+    ok = uart16550_lz_decode(dev, (uint8_t *)mem, size, csize);
+    // a stream shortened by lost bytes runs into the CRC32, then stops
+    for (i = 0; i < 4 && (c = uart16550_getc_timeout(dev, idle)) >= 0; i++)
+      crc_le[i] = c;
+    if (i == 4 && ok &&
+        (uart16550_crc32(0xFFFFFFFF, (uint8_t *)mem, size) ^ 0xFFFFFFFF) ==
+            uart16550_get_le32(crc_le))
+      break;
+    // let the rest of this attempt go by before asking for another
+    while (uart16550_getc_timeout(dev, idle) >= 0)
+      ;
+    uart16550_dev_putc(dev, NAK);
+  }
+  uart16550_dev_putc(dev, ACK);
+
+  return size;
+}
+
+// Receive blocks into their place in mem until every block is received and
+// the sender ends with EOT; acknowledge each one, NAK corrupted ones.
+static int uart16550_recvfile_framed(struct uart16550_dev *dev, char *mem) {
+  uint8_t hdr[6];
+  uint8_t crc_le[4];
+  uint8_t scratch[16];
+  uint8_t *dst;
+  uint32_t size = 0, nblocks = 0, base = 0, mask = 0;
+  uint32_t idx, len, crc, n;
+  int have_size = 0;
+
+  for (;;) {
+    // resynchronize on the start of a block
+    uart16550_dev_read(dev, hdr, 1);
+    if (hdr[0] == EOT && have_size && base == nblocks)
+      break;
+    if (hdr[0] != SOH)
+      continue;
+    uart16550_dev_read(dev, hdr, 6);
+    idx = uart16550_get_le32(hdr);
+    len = hdr[4] | (hdr[5] << 8);
+    crc = uart16550_crc32(0xFFFFFFFF, hdr, 6);
+
+    if (idx == UART16550_FRAME_HDR) {
+      if (len != 4)
+        continue;
+      uart16550_dev_read(dev, scratch, 4);
+      uart16550_dev_read(dev, crc_le, 4);
+      crc = uart16550_crc32(crc, scratch, 4) ^ 0xFFFFFFFF;
+      if (crc != uart16550_get_le32(crc_le)) {
+        uart16550_ctrl_send(dev, NAK, idx);
+        continue;
+      }
+      if (!have_size) {
+        size = uart16550_get_le32(scratch);
+        nblocks = (size + UART16550_FRAME_SIZE - 1) / UART16550_FRAME_SIZE;
+        have_size = 1;
+      }
+      uart16550_ctrl_send(dev, ACK, idx);
+      continue;
+    }
+
+    // a corrupted header looks like a block that cannot exist: resynchronize
+    if (!have_size || idx >= nblocks || len != uart16550_frame_len(size, idx))
+      continue;
+
+    if (idx < base || idx - base >= UART16550_FRAME_WINDOW ||
+        ((mask >> (idx - base)) & 1)) {
+      // already received (the ACK was lost) or outside the window: drop it
+      for (len += 4; len; len -= n) {
+        n = (len < sizeof(scratch)) ? len : sizeof(scratch);
+        uart16550_dev_read(dev, scratch, n);
+      }
+      if (idx < base || ((mask >> (idx - base)) & 1))
+        uart16550_ctrl_send(dev, ACK, idx);
+      continue;
+    }
+
+    dst = (uint8_t *)mem + idx * UART16550_FRAME_SIZE;
+    uart16550_dev_read(dev, dst, len);
+    uart16550_dev_read(dev, crc_le, 4);
+    crc = uart16550_crc32(crc, dst, len) ^ 0xFFFFFFFF;
+    if (crc != uart16550_get_le32(crc_le)) {
+      uart16550_ctrl_send(dev, NAK, idx);
+      continue;
+    }
+    uart16550_ctrl_send(dev, ACK, idx);
+    mask |= 1u << (idx - base);
+    while (mask & 1) {
+      mask >>= 1;
+      base++;
+    }
+  }
+
+  return size;
+}
+
+// Send the header until acknowledged, then keep a window of blocks in flight
+// and resend those that get a NAK; the receiver NAKs lost blocks on timeout.
+static void uart16550_sendfile_framed(struct uart16550_dev *dev,
+                                      int file_size, char *mem) {
+  const uint8_t *src = (const uint8_t *)mem;
+  uint32_t size = file_size;
+  uint32_t nblocks = (size + UART16550_FRAME_SIZE - 1) / UART16550_FRAME_SIZE;
+  uint32_t base = 0, next = 0, mask = 0;
+  uint32_t idx;
+  uint8_t size_le[4];
+  uint8_t ctrl;
+
+  uart16550_put_le32(size_le, size);
+  do
+    uart16550_frame_send(dev, UART16550_FRAME_HDR, size_le, 4);
+  while (!uart16550_ctrl_recv(dev, &ctrl, &idx) || ctrl != ACK ||
+         idx != UART16550_FRAME_HDR);
+
+  while (base < nblocks) {
+    // fill the window while no acknowledgement is waiting
+    if (next < nblocks && next - base < UART16550_FRAME_WINDOW &&
+        !uart16550_dev_rxcount(dev)) {
+      uart16550_frame_send(dev, next, src + next * UART16550_FRAME_SIZE,
+                           uart16550_frame_len(size, next));
+      next++;
+      continue;
+    }
+    if (!uart16550_ctrl_recv(dev, &ctrl, &idx) || idx < base || idx >= next)
+      continue;
+    if (ctrl == ACK) {
+      mask |= 1u << (idx - base);
+      while (mask & 1) {
+        mask >>= 1;
+        base++;
+      }
+    } else if (!((mask >> (idx - base)) & 1)) {
+      uart16550_frame_send(dev, idx, src + idx * UART16550_FRAME_SIZE,
+                           uart16550_frame_len(size, idx));
+    }
+  }
+
+  uart16550_dev_putc(dev, EOT);
 }
 
 // Receives file into mem
-int uart16550_recvfile(char *file_name, char *mem) {
+int uart16550_dev_recvfile(struct uart16550_dev *dev, char *file_name,
+                           char *mem) {
+  int caps;
 
-  uart16550_puts(UART_PROGNAME);
-  uart16550_puts(": requesting to receive file\n");
+  uart16550_dev_puts(dev, UART_PROGNAME);
+  uart16550_dev_puts(dev, ": requesting to receive file\n");
 
-  // send file receive request
-  uart16550_putc(FRX);
+  // send file receive request, compressed or framed if the console supports it
+  caps = uart16550_probe(dev);
+  if (caps & PROBE_LZ)
+    uart16550_dev_putc(dev, FRXZ);
+  else
+    uart16550_dev_putc(dev, (caps & PROBE_FRAMED) ? FRXB : FRX);
 
   // clear input buffer
-  while (uart16550_rxready())
-    uart16550_getc();
+  while (uart16550_dev_rxready(dev))
+    uart16550_dev_getc(dev);
 
   // send file name
-  uart16550_sendstr(file_name);
+  uart16550_dev_sendstr(dev, file_name);
+
+  if (caps) {
+    int file_size = (caps & PROBE_LZ) ? uart16550_recvfile_lz(dev, mem)
+                                      : uart16550_recvfile_framed(dev, mem);
+    uart16550_dev_puts(dev, UART_PROGNAME);
+    uart16550_dev_puts(dev, ": file received\n");
+    return file_size;
+  }
 
   // receive file size
-  int file_size = (unsigned int)uart16550_getc();
-  file_size |= ((unsigned int)uart16550_getc()) << 8;
-  file_size |= ((unsigned int)uart16550_getc()) << 16;
-  file_size |= ((unsigned int)uart16550_getc()) << 24;
+  uint8_t size_le[4];
+  uart16550_dev_read(dev, size_le, 4);
+  int file_size = (unsigned int)size_le[0];
+  file_size |= ((unsigned int)size_le[1]) << 8;
+  file_size |= ((unsigned int)size_le[2]) << 16;
+  file_size |= ((unsigned int)size_le[3]) << 24;
 
   // Disabled this because we may want to write files starting at address 0 (to
   // initialize memory of iob_system).
@@ -138,41 +859,316 @@ int uart16550_recvfile(char *file_name, char *mem) {
   // }
 
   // send ACK before receiving file
-  uart16550_putc(ACK);
+  uart16550_dev_putc(dev, ACK);
 
   // write file to memory
-  for (int i = 0; i < file_size; i++) {
-    mem[i] = uart16550_getc();
-  }
+  uart16550_dev_read(dev, mem, file_size);
 
-  uart16550_puts(UART_PROGNAME);
-  uart16550_puts(": file received\n");
+  uart16550_dev_puts(dev, UART_PROGNAME);
+  uart16550_dev_puts(dev, ": file received\n");
 
   return file_size;
 }
 
 // Sends mem contents to a file
-void uart16550_sendfile(char *file_name, int file_size, char *mem) {
+void uart16550_dev_sendfile(struct uart16550_dev *dev, char *file_name,
+                            int file_size, char *mem) {
+  int framed;
 
-  uart16550_puts(UART_PROGNAME);
-  uart16550_puts(": requesting to send file\n");
+  uart16550_dev_puts(dev, UART_PROGNAME);
+  uart16550_dev_puts(dev, ": requesting to send file\n");
 
-  // send file transmit command
-  uart16550_putc(FTX);
+  // send file transmit command, framed if the console supports it
+  framed = uart16550_probe(dev) & PROBE_FRAMED;
+  uart16550_dev_putc(dev, framed ? FTXB : FTX);
 
   // send file name
-  uart16550_sendstr(file_name);
+  uart16550_dev_sendstr(dev, file_name);
+
+  if (framed) {
+    uart16550_sendfile_framed(dev, file_size, mem);
+  } else {
+    // send file size
+    char size_le[4];
+    size_le[0] = (char)(file_size & 0x0ff);
+    size_le[1] = (char)((file_size & 0x0ff00) >> 8);
+    size_le[2] = (char)((file_size & 0x0ff0000) >> 16);
+    size_le[3] = (char)((file_size & 0x0ff000000) >> 24);
+    uart16550_dev_write(dev, size_le, 4);
+
+    // send file contents
+    uart16550_dev_write(dev, mem, file_size);
+  }
+
+  uart16550_dev_puts(dev, UART_PROGNAME);
+  uart16550_dev_puts(dev, ": file sent\n");
+}
+
+// STREAMED FILE RECEPTION
+// Move received bytes to the chunk being filled
+size_t uart16550_dev_stream_poll(struct uart16550_dev *dev) {
+  size_t n;
+
+  if (dev->rx_left == 0)
+    return 0;
+  n = uart16550_dev_rxcount(dev);
+  if (n > dev->rx_left)
+    n = dev->rx_left;
+  STATS_ADD(dev, rx_bytes, n);
+  dev->rx_left -= n;
+  while (n--)
+    *dev->rx_dst++ = UART16550_RD8(dev, 0);
+  return dev->rx_left;
+}
+
+// Receives file in chunks, handing each one to cb while the next one arrives
+int uart16550_dev_recvfile_stream(struct uart16550_dev *dev, char *file_name,
+                                  char *buf, size_t chunk,
+                                  uart16550_chunk_cb cb, void *ctx) {
+  uint8_t le[4];
+  char *cur = buf, *next;
+  char *tmp;
+  size_t offset, len, next_len;
+  int file_size;
+
+  uart16550_dev_puts(dev, UART_PROGNAME);
+  uart16550_dev_puts(dev, ": requesting to stream file\n");
+
+  if (!(uart16550_probe(dev) & PROBE_STREAM)) {
+    uart16550_dev_puts(dev, UART_PROGNAME);
+    uart16550_dev_puts(dev, ": console does not stream files\n");
+    return -1;
+  }
+  uart16550_dev_putc(dev, FRXS);
+
+  // a chunk in flight fits in the RX FIFO, however long cb runs
+  if (chunk > UART16550_FIFO_DEPTH)
+    chunk = UART16550_FIFO_DEPTH;
+  next = buf + chunk;
+
+  // clear input buffer
+  while (uart16550_dev_rxready(dev))
+    uart16550_dev_getc(dev);
+
+  // send file name and chunk size, receive file size
+  uart16550_dev_sendstr(dev, file_name);
+  uart16550_put_le32(le, chunk);
+  uart16550_dev_write(dev, le, 4);
+  uart16550_dev_read(dev, le, 4);
+  file_size = uart16550_get_le32(le);
+
+  // each ACK asks the console for one more chunk
+  len = ((size_t)file_size < chunk) ? (size_t)file_size : chunk;
+  if (len) {
+    uart16550_dev_putc(dev, ACK);
+    uart16550_dev_read(dev, cur, len);
+  }
+  for (offset = 0; len; offset += len, len = next_len) {
+    next_len = file_size - offset - len;
+    if (next_len > chunk)
+      next_len = chunk;
+    if (next_len) {
+      dev->rx_dst = next;
+      dev->rx_left = next_len;
+      uart16550_dev_putc(dev, ACK);
+    }
+    cb(ctx, cur, len, offset);
+    while (uart16550_dev_stream_poll(dev))
+      ;
+    tmp = cur;
+    cur = next;
+    next = tmp;
+  }
+
+  uart16550_dev_puts(dev, UART_PROGNAME);
+  uart16550_dev_puts(dev, ": file received\n");
+
+  return file_size;
+}
+
+#ifdef UART16550_STATS
+// STATISTICS
+void uart16550_dev_get_stats(struct uart16550_dev *dev,
+                             struct uart16550_stats *stats) {
+  *stats = dev->stats;
+}
+
+// Sends the statistics as a word count and little endian words
+int uart16550_dev_sendstats(struct uart16550_dev *dev) {
+  struct uart16550_stats stats = dev->stats;
+  const uint32_t *w = (const uint32_t *)&stats;
+  uint8_t le[4];
+  size_t i;
+
+  if (!(uart16550_probe(dev) & PROBE_STATS))
+    return 0;
+  uart16550_dev_putc(dev, STATS);
+  uart16550_dev_putc(dev, sizeof(stats) / 4);
+  for (i = 0; i < sizeof(stats) / 4; i++) {
+    uart16550_put_le32(le, w[i]);
+    uart16550_dev_write(dev, le, 4);
+  }
+  return 1;
+}
 
-  // send file size
-  uart16550_putc((char)(file_size & 0x0ff));
-  uart16550_putc((char)((file_size & 0x0ff00) >> 8));
-  uart16550_putc((char)((file_size & 0x0ff0000) >> 16));
-  uart16550_putc((char)((file_size & 0x0ff000000) >> 24));
+#endif
+// BAUD RATE NEGOTIATION
+static const uint8_t uart16550_baud_pattern[16] = {
+    0x55, 0xAA, 0x00, 0xFF, 0x0F, 0xF0, 0x33, 0xCC,
+    0x01, 0x80, 0x7E, 0x81, 0x5A, 0xA5, 0x3C, 0xC3};
 
-  // send file contents
-  for (int i = 0; i < file_size; i++)
-    uart16550_putc(mem[i]);
+// Switch to a mult times faster divisor if the console receives and echoes
+// the test pattern; otherwise fall back to the current one.
+static int uart16550_upshift_try(struct uart16550_dev *dev, uint8_t mult) {
+  uint16_t div = dev->div;
+  // UART16550_BAUD_TIMEOUT characters of 160 * div cycles at the current
+  // rate; longer when counted in LSR reads, without UART16550_CYCLES()
+  uint32_t wait = uart16550_char_cycles(div, UART16550_BAUD_TIMEOUT);
+  uint8_t rx[sizeof(uart16550_baud_pattern)];
+  unsigned int i;
+  int c;
+
+  uart16550_dev_putc(dev, BRC);
+  uart16550_dev_putc(dev, (char)mult);
+  if (uart16550_getc_timeout(dev, wait) != ACK)
+    return 0;
+
+  // the console switches right after its ACK and sends the pattern. The
+  // divisor is rounded, so the new rate can differ from the console's exact
+  // baud * mult: div 3 and mult 2 give 1.5 times the rate. The pattern check
+  // tells whether both ends still agree.
+  uart16550_dev_txwait(dev);
+  uart16550_set_div(dev, (div + mult / 2) / mult);
+  for (i = 0; i < sizeof(rx); i++) {
+    if ((c = uart16550_getc_timeout(dev, wait)) < 0)
+      break;
+    rx[i] = (uint8_t)c;
+  }
+  if (i == sizeof(rx) && !memcmp(rx, uart16550_baud_pattern, sizeof(rx))) {
+    uart16550_dev_write(dev, rx, sizeof(rx));
+    if (uart16550_getc_timeout(dev, wait) == ACK) {
+      // the console keeps the new rate only once it gets this confirmation
+      uart16550_dev_putc(dev, ACK);
+      uart16550_dev_txwait(dev);
+      return 1;
+    }
+  }
+
+  // the console falls back once it misses the echo; drop any noise until the
+  // line is quiet for a full timeout
+  uart16550_dev_txwait(dev);
+  uart16550_set_div(dev, div);
+  while (uart16550_getc_timeout(dev, wait) >= 0)
+    ;
+  return 0;
+}
+
+// Negotiates a faster baud rate with the console
+uint8_t uart16550_dev_upshift(struct uart16550_dev *dev, uint8_t max_mult) {
+  uint8_t mult;
+
+  if (!(uart16550_probe(dev) & PROBE_BAUD))
+    return 1;
+
+  for (mult = max_mult; mult > 1; mult /= 2)
+    if ((dev->div + mult / 2) / mult && uart16550_upshift_try(dev, mult))
+      return mult;
+  return 1;
+}
+
+// Functions on the default instance
+void uart16550_init(int base_address, uint16_t div) {
+  uart16550_dev_init(&uart16550_default, base_address, div);
+}
+
+// Change UART base
+int uart16550_base(int base_address) {
+  int previous = uart16550_default.base;
+  uart16550_default.base = base_address;
+  uart16550_default.tx_room = 0;
+  return previous;
+}
+
+void uart16550_finish() { uart16550_dev_finish(&uart16550_default); }
+
+void uart16550_bputc(char c) { uart16550_dev_bputc(&uart16550_default, c); }
+
+void uart16550_flush() { uart16550_dev_flush(&uart16550_default); }
+
+int uart16550_flush_nb() { return uart16550_dev_flush_nb(&uart16550_default); }
+
+char uart16550_txready() { return uart16550_dev_txready(&uart16550_default); }
+
+char uart16550_txfifo_empty() {
+  return uart16550_dev_txfifo_empty(&uart16550_default);
+}
+
+void uart16550_txwait() { uart16550_dev_txwait(&uart16550_default); }
+
+char uart16550_rxready() { return uart16550_dev_rxready(&uart16550_default); }
+
+void uart16550_rxwait() { uart16550_dev_rxwait(&uart16550_default); }
+
+void uart16550_putc(char c) { uart16550_dev_putc(&uart16550_default, c); }
+
+void uart16550_write(const void *buf, size_t len) {
+  uart16550_dev_write(&uart16550_default, buf, len);
+}
+
+void uart16550_puts(const char *s) {
+  uart16550_dev_puts(&uart16550_default, s);
+}
+
+void uart16550_sendstr(char *name) {
+  uart16550_dev_sendstr(&uart16550_default, name);
+}
+
+void uart16550_sendfile(char *file_name, int file_size, char *mem) {
+  uart16550_dev_sendfile(&uart16550_default, file_name, file_size, mem);
+}
+
+char uart16550_getc() { return uart16550_dev_getc(&uart16550_default); }
+
+size_t uart16550_rxcount() { return uart16550_dev_rxcount(&uart16550_default); }
+
+void uart16550_read(void *buf, size_t len) {
+  uart16550_dev_read(&uart16550_default, buf, len);
+}
+
+void uart16550_isr() { uart16550_dev_isr(&uart16550_default); }
+
+int uart16550_putc_nb(char c) {
+  return uart16550_dev_putc_nb(&uart16550_default, c);
+}
+
+int uart16550_getc_nb(char *c) {
+  return uart16550_dev_getc_nb(&uart16550_default, c);
+}
+
+int uart16550_recvfile(char *file_name, char *mem) {
+  return uart16550_dev_recvfile(&uart16550_default, file_name, mem);
+}
+
+int uart16550_recvfile_stream(char *file_name, char *buf, size_t chunk,
+                              uart16550_chunk_cb cb, void *ctx) {
+  return uart16550_dev_recvfile_stream(&uart16550_default, file_name, buf,
+                                       chunk, cb, ctx);
+}
+
+size_t uart16550_stream_poll() {
+  return uart16550_dev_stream_poll(&uart16550_default);
+}
+
+uint8_t uart16550_upshift(uint8_t max_mult) {
+  return uart16550_dev_upshift(&uart16550_default, max_mult);
+}
+
+#ifdef UART16550_STATS
+void uart16550_get_stats(struct uart16550_stats *stats) {
+  uart16550_dev_get_stats(&uart16550_default, stats);
+}
 
-  uart16550_puts(UART_PROGNAME);
-  uart16550_puts(": file sent\n");
+int uart16550_sendstats() {
+  return uart16550_dev_sendstats(&uart16550_default);
 }
+#endif
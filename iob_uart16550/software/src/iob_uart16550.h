@@ -14,10 +14,25 @@
  *      - initialization and setup
  *      - basic control functions
  *      - single character send and receive functions
+ *      - burst transfers that fill the TX FIFO without per-byte polling
+ *      - burst receive that drains the RX FIFO using its fill level
+ *      - interrupt driven, non-blocking send and receive through ring buffers
  *      - simple protocol for multi byte transfers
+ *      - handle based API for systems with several IOb-UART16550 instances
+ *      - baud rate upshift negotiated with the console
+ *      - buffered output for printf backends, flushed on newline
+ *      - streamed file reception with a per-chunk callback
+ *      - optional link statistics (UART16550_STATS)
+ *
+ * Every function has a `uart16550_dev_` variant that takes an instance handle.
+ * The functions without a handle act on a default instance, selected by
+ * uart16550_init() and uart16550_base().
  *
  */
 
+#ifndef H_IOB_UART16550_H
+#define H_IOB_UART16550_H
+
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -28,6 +43,72 @@
  */
 #define UART_PROGNAME "IOb-UART"
 
+/**
+ * @def UART16550_FIFO_DEPTH
+ * @brief Depth of the IOb-UART16550 TX and RX FIFOs (in bytes).
+ */
+#define UART16550_FIFO_DEPTH 256
+
+/**
+ * @def UART16550_RING_SIZE
+ * @brief Size of the interrupt driven TX and RX ring buffers (in bytes).
+ * Must be a power of 2.
+ */
+#ifndef UART16550_RING_SIZE
+#define UART16550_RING_SIZE 256
+#endif
+
+/**
+ * @def UART16550_WFI
+ * @brief Define to sleep in wait loops instead of polling the line status.
+ *
+ * uart16550_txwait(), uart16550_rxwait() and the functions built on them
+ * enable only the THRE or RDA (with character timeout) interrupt and execute
+ * UART16550_WFI_INSN() (RISC-V `wfi` by default) until the condition holds,
+ * then restore the interrupt enables. interrupt_o must reach the core as a
+ * wake-up source without being taken by uart16550_isr(), for example enabled
+ * in `mie` with `mstatus.MIE` clear. Without it, the loops poll.
+ */
+
+/**
+ * @def UART16550_IOB_BUS
+ * @brief Define to access the registers through iob_read() and iob_write().
+ *
+ * For host builds where the UART is not memory mapped, such as the bus
+ * transaction budget test. Without it, registers are accessed with loads and
+ * stores at the instance base address.
+ */
+
+/**
+ * @def UART16550_STATS
+ * @brief Define to count transfers, line errors and busy-wait time.
+ *
+ * Errors are taken from the LSR reads the driver does anyway, so no bus
+ * access is added. Without the define the counters and their API are compiled
+ * out. Must be defined alike for the driver and its users.
+ */
+
+/**
+ * @def UART16550_STATS_TIME
+ * @brief Time base of the busy-wait counters, given the instance handle.
+ * Defaults to the LSR read count; define it to read a cycle counter instead.
+ */
+
+/**
+ * @def UART16550_CYCLES
+ * @brief Free-running clock cycle counter (e.g. RISC-V rdcycle), for the
+ * receive timeouts. Without it each LSR read counts as one clock cycle, so a
+ * timeout lasts at least as long as specified, and longer on slower buses.
+ */
+
+/**
+ * @def UART16550_OBUF_SIZE
+ * @brief Size of the buffered output of uart16550_bputc() (in bytes).
+ */
+#ifndef UART16550_OBUF_SIZE
+#define UART16550_OBUF_SIZE 128
+#endif
+
 // UART16550 commands
 /**
  * @def STX
@@ -70,13 +151,124 @@
  * @brief File reception.
  * Signal file reception request.
  */
-#define STX 2 // start text
-#define ETX 3 // end text
-#define EOT 4 // end of transission
-#define ENQ 5 // enquiry
-#define ACK 6 // acklowledge
-#define FTX 7 // transmit file
-#define FRX 8 // receive file
+/**
+ * @def SOH
+ *
+ * @brief Start of heading.
+ * Signal start of a framed file transfer block.
+ */
+/**
+ * @def FTXB
+ *
+ * @brief Framed file transfer.
+ * Signal file transfer request using CRC protected blocks.
+ */
+/**
+ * @def FRXB
+ *
+ * @brief Framed file reception.
+ * Signal file reception request using CRC protected blocks.
+ */
+/**
+ * @def NAK
+ *
+ * @brief Negative acknowledge.
+ * Signal reception of a corrupted block.
+ */
+/**
+ * @def SYN
+ *
+ * @brief Synchronous idle.
+ * Query (and answer) support for framed file transfers.
+ */
+/**
+ * @def FRXZ
+ *
+ * @brief Compressed file reception.
+ * Signal file reception request with LZ compressed contents. Also sent by the
+ * console after the SYN answer when it can compress uploads.
+ */
+/**
+ * @def FRXS
+ *
+ * @brief Streamed file reception.
+ * Signal file reception request paced by chunk. Also sent by the console after
+ * the SYN answer when it can stream uploads.
+ */
+/**
+ * @def STATS
+ *
+ * @brief Statistics report.
+ * Signal link statistics report. Also sent by the console after the SYN answer
+ * when it prints them.
+ */
+/**
+ * @def BRC
+ *
+ * @brief Baud rate change.
+ * Signal baud rate change request. Also sent by the console after the SYN
+ * answer when it can change its baud rate.
+ */
+#define SOH 1    // start of heading
+#define STX 2    // start text
+#define ETX 3    // end text
+#define EOT 4    // end of transission
+#define ENQ 5    // enquiry
+#define ACK 6    // acklowledge
+#define FTX 7    // transmit file
+#define FRX 8    // receive file
+#define FTXB 14  // transmit file, framed
+#define FRXB 15  // receive file, framed
+#define STATS 16 // statistics report
+#define FRXZ 18  // receive file, compressed
+#define FRXS 19  // receive file, streamed
+#define BRC 20   // baud rate change
+#define NAK 21   // negative acknowledge
+#define SYN 22   // framed transfer support query
+
+/**
+ * @def UART16550_FRAME_SIZE
+ * @brief Payload size of framed file transfer blocks (in bytes).
+ */
+#define UART16550_FRAME_SIZE 256
+
+/**
+ * @def UART16550_FRAME_WINDOW
+ * @brief Maximum number of unacknowledged framed transfer blocks (up to 32).
+ */
+#define UART16550_FRAME_WINDOW 16
+
+/**
+ * @def UART16550_FRAME_HDR
+ * @brief Block index of the framed transfer header, which carries the size.
+ */
+#define UART16550_FRAME_HDR 0xFFFFFFFF
+
+/**
+ * @def UART16550_LZ_WINDOW
+ * @brief Maximum match offset of compressed file transfers (in bytes).
+ */
+#define UART16550_LZ_WINDOW 0xFFFF
+
+/**
+ * @def UART16550_LZ_TIMEOUT
+ * @brief Line idle time after which a compressed file transfer attempt is
+ * taken as cut short by lost bytes (in characters, of 160 * div cycles).
+ * The default is 27 ms at 3 Mbaud and 0.7 s at 115200 baud, well above the
+ * latency of USB serial adapters; the console resends after 5 s of silence.
+ */
+#ifndef UART16550_LZ_TIMEOUT
+#define UART16550_LZ_TIMEOUT 8192
+#endif
+
+/**
+ * @def UART16550_BAUD_TIMEOUT
+ * @brief Minimum wait for each answer of the console during a baud rate
+ * change (in characters at the initial baud rate, of 160 * div cycles).
+ */
+#ifndef UART16550_BAUD_TIMEOUT
+#define UART16550_BAUD_TIMEOUT 4096
+#endif
 
 // UART16550 functions
 
@@ -104,8 +296,8 @@ int uart16550_base(int base_address);
 
 /** @brief Close transmission.
  *
- * Send end of transmission (EOT) command via UART16550.
- * Active wait until TX transfer is complete.
+ * Flush buffered output and send end of transmission (EOT) command via
+ * UART16550. Active wait until TX transfer is complete.
  * Use this function to close console program.
  *
  * @return void.
@@ -120,6 +312,15 @@ void uart16550_finish();
  */
 char uart16550_txready();
 
+/** @brief Check if TX FIFO is empty
+ *
+ * Check if the UART16550 TX FIFO has been drained (LSR bit 5). The shift
+ * register may still be sending the last byte.
+ *
+ * @return TX FIFO empty flag
+ */
+char uart16550_txfifo_empty();
+
 /** @brief Wait for TX.
  *
  * Active wait until TX is ready to process new byte to send.
@@ -153,6 +354,17 @@ void uart16550_rxwait();
  */
 void uart16550_putc(char c);
 
+/** @brief Send buffer.
+ *
+ * Burst send a buffer via UART16550. Waits for the TX FIFO to drain and then
+ * pushes up to UART16550_FIFO_DEPTH bytes without reading the line status.
+ *
+ * @param buf Pointer to data to send.
+ * @param len Number of bytes to send.
+ * @return void.
+ */
+void uart16550_write(const void *buf, size_t len);
+
 /** @brief Print string.
  *
  * Send string via UART16550 to be printed by in console program.
@@ -162,6 +374,39 @@ void uart16550_putc(char c);
  */
 void uart16550_puts(const char *s);
 
+/** @brief Print char through the output buffer.
+ *
+ * Backend for printf and other character-at-a-time output. Characters are
+ * stored in a UART16550_OBUF_SIZE buffer that is handed to the TX FIFO on
+ * newline, when the buffer is full, before any unbuffered send, while waiting
+ * for RX data and on uart16550_finish(). Only as much as the TX FIFO has room
+ * for is pushed, so the call returns without waiting unless both the buffer
+ * and the TX FIFO are full.
+ *
+ * Point the character output of printf at it, as example_firmware.c does
+ * with the _putchar() hook of iob_printf.h.
+ *
+ * @param c Character to print.
+ * @return void.
+ */
+void uart16550_bputc(char c);
+
+/** @brief Flush buffered output.
+ *
+ * Send everything stored by uart16550_bputc(), waiting for TX FIFO room.
+ *
+ * @return void.
+ */
+void uart16550_flush();
+
+/** @brief Non-blocking flush of buffered output.
+ *
+ * Push as much of the buffered output as the TX FIFO has room for.
+ *
+ * @return Number of bytes still buffered.
+ */
+int uart16550_flush_nb();
+
 /** @brief Send file.
  *
  * Send variable size file via UART16550.
@@ -171,6 +416,17 @@ void uart16550_puts(const char *s);
  *  3. Send file_size (in little endian format).
  *  4. Send file.
  *
+ * If the console answers the SYN query, the framed protocol is used instead:
+ *  1. Send framed file transmit (FTXB) command.
+ *  2. Send file_name.
+ *  3. Send header block with file_size until ACK.
+ *  4. Send blocks of UART16550_FRAME_SIZE bytes, keeping up to
+ *     UART16550_FRAME_WINDOW unacknowledged. Resend blocks that get a NAK.
+ *  5. Send EOT when every block is acknowledged.
+ *
+ * Blocks are `SOH, index, length, payload, CRC32` and acknowledgements are
+ * `ACK|NAK, index, CRC32`, all in little endian format.
+ *
  * @param file_name Pointer to file name string.
  * @param file_size Size of file to be sent.
  * @param mem Pointer to file.
@@ -186,6 +442,62 @@ void uart16550_sendfile(char *file_name, int file_size, char *mem);
  */
 char uart16550_getc();
 
+/** @brief Get number of received bytes.
+ *
+ * Read the RX FIFO fill level (rf_count) from debug register 2.
+ *
+ * @return Number of bytes waiting in the RX FIFO.
+ */
+size_t uart16550_rxcount();
+
+/** @brief Receive buffer.
+ *
+ * Burst receive a buffer from UART16550. Reads the RX FIFO fill level once and
+ * then pops that many bytes back-to-back, until len bytes are received.
+ *
+ * @param buf Pointer to store received data.
+ * @param len Number of bytes to receive.
+ * @return void.
+ */
+void uart16550_read(void *buf, size_t len);
+
+/** @brief UART16550 interrupt service routine.
+ *
+ * Call from the interrupt handler connected to `interrupt_o`. Decodes IIR and
+ * services every pending source: RDA and character timeout (TI) move the RX
+ * FIFO into the RX ring buffer, THRE refills the TX FIFO from the TX ring
+ * buffer and RLS clears the line status.
+ *
+ * The ring buffers are single-producer/single-consumer: this routine is the
+ * only consumer of the TX ring and the only producer of the RX ring. Do not mix
+ * uart16550_getc()/uart16550_read() with the interrupt driven receive path.
+ * Blocking sends (uart16550_putc(), uart16550_write() and buffered output)
+ * first send what is left in the TX ring themselves, with the THRE interrupt
+ * masked, so they also work from this routine's context or with interrupts
+ * off.
+ *
+ * @return void.
+ */
+void uart16550_isr();
+
+/** @brief Non-blocking print char.
+ *
+ * Queue character in the TX ring buffer to be sent by uart16550_isr().
+ *
+ * @param c Character to send.
+ * @return 1 if the character was queued, 0 if the TX ring buffer is full.
+ */
+int uart16550_putc_nb(char c);
+
+/** @brief Non-blocking get char.
+ *
+ * Take a character from the RX ring buffer filled by uart16550_isr().
+ *
+ * @param c Pointer to store the received character.
+ * @return 1 if a character was received, 0 if the RX ring buffer is empty.
+ */
+int uart16550_getc_nb(char *c);
+
 /** @brief Receive file.
  *
  * Request variable size file via UART16550.
@@ -196,6 +508,27 @@ char uart16550_getc();
  *  4. Send ACK command.
  *  5. Receive file.
  *
+ * If the console answers the SYN query, the framed protocol of
+ * uart16550_sendfile() is used with reversed roles, after a framed file
+ * receive (FRXB) command. Each block is written straight to its place in mem.
+ *
+ * If the console also announces compression (FRXZ after the SYN answer), the
+ * file is sent LZ compressed instead:
+ *  1. Send compressed file receive (FRXZ) command.
+ *  2. Send file_name.
+ *  3. Receive file_size and compressed size (little endian).
+ *  4. Send ACK command.
+ *  5. Receive compressed file, decompressing into mem as it arrives.
+ *  6. Receive CRC32 of the file and send ACK if it matches. Otherwise, or if
+ *     the line goes quiet for UART16550_LZ_TIMEOUT characters before the
+ *     CRC32 is complete, wait for it to stay quiet, send NAK and repeat
+ *     from 4.
+ *
+ * The compressed stream is a sequence of `token, [literal length],
+ * literals, offset, [match length]` in the LZ4 block layout, the last one
+ * without offset. Matches reference the data already written to mem, so no
+ * window buffer is needed.
+ *
  * If memory pointer is not initialized, allocates memory for incoming file.
  *
  * @param file_name Pointer to file name string.
@@ -203,3 +536,379 @@ char uart16550_getc();
  * @return Size of received file.
  */
 int uart16550_recvfile(char *file_name, char *mem);
+
+/** @brief Per-chunk consumer of uart16550_recvfile_stream().
+ *
+ * @param ctx User pointer given to uart16550_recvfile_stream().
+ * @param data Received chunk.
+ * @param len Chunk length.
+ * @param offset Chunk offset in the file.
+ */
+typedef void (*uart16550_chunk_cb)(void *ctx, char *data, size_t len,
+                                   size_t offset);
+
+/** @brief Receive file in chunks.
+ *
+ * Request variable size file via UART16550 and hand it to cb chunk by chunk,
+ * without holding the whole file in memory.
+ * Order of commands:
+ *  1. Send streamed file receive (FRXS) command.
+ *  2. Send file_name.
+ *  3. Send chunk size (little endian).
+ *  4. Receive file_size (little endian).
+ *  5. For each chunk: send ACK, receive chunk.
+ *
+ * buf holds two chunks. The ACK for the next chunk is sent before cb is called
+ * on the current one, so the next chunk arrives while cb runs. The chunk size
+ * is capped to UART16550_FIFO_DEPTH, so that chunk waits in the RX FIFO
+ * however long cb runs and no byte is lost. A cb that waits (for example for a
+ * flash write) may call uart16550_stream_poll() to move it to buf earlier.
+ *
+ * Requires the console to announce support (FRXS after the SYN answer).
+ *
+ * @param file_name Pointer to file name string.
+ * @param buf Pointer to 2 * chunk bytes of reception buffers.
+ * @param chunk Chunk size, at most UART16550_FIFO_DEPTH.
+ * @param cb Chunk consumer.
+ * @param ctx User pointer passed to cb.
+ * @return Size of received file, -1 if the console does not stream files.
+ */
+int uart16550_recvfile_stream(char *file_name, char *buf, size_t chunk,
+                              uart16550_chunk_cb cb, void *ctx);
+
+/** @brief Keep a streamed file reception going.
+ *
+ * Move the bytes waiting in the RX FIFO to the chunk being received. Optional
+ * in uart16550_recvfile_stream() callbacks, to keep the RX FIFO low.
+ *
+ * @return Number of bytes still missing from the chunk being received.
+ */
+size_t uart16550_stream_poll();
+
+#ifdef UART16550_STATS
+struct uart16550_stats;
+
+/** @brief Get link statistics.
+ *
+ * Copy the counters of the default instance (needs UART16550_STATS).
+ *
+ * @param stats Pointer to store the statistics.
+ * @return void.
+ */
+void uart16550_get_stats(struct uart16550_stats *stats);
+
+/** @brief Send link statistics to the console.
+ *
+ * Send statistics report (STATS) command, the number of words and the words
+ * of struct uart16550_stats (little endian) for the console to print.
+ * Requires the console to announce support (STATS after the SYN answer).
+ *
+ * @return 1 if sent, 0 if the console does not print statistics.
+ */
+int uart16550_sendstats();
+#endif
+
+/** @brief Negotiate a faster baud rate.
+ *
+ * Ask the console for max_mult times the current baud rate, halving the
+ * multiplier on each failed attempt. Order of commands for each attempt:
+ *  1. Send baud rate change (BRC) command and the multiplier.
+ *  2. Receive ACK (or NAK if the console refuses it).
+ *  3. Switch to the divisor divided by the multiplier.
+ *  4. Receive 16 byte test pattern and echo it.
+ *  5. Receive ACK.
+ *  6. Send ACK to confirm; the console falls back without it.
+ *
+ * The divisor is rounded, so the new rate may differ from the console's
+ * exact multiple; the test pattern checks that both ends still agree.
+ *
+ * If the first ACK, the pattern or the last ACK from the console does not
+ * arrive within UART16550_BAUD_TIMEOUT characters, the divisor is restored
+ * and the next multiplier is tried once the line is quiet. Consoles that do
+ * not announce support (BRC after the SYN answer) are left at the current
+ * rate.
+ *
+ * Call it while the RX interrupt is disabled, before large transfers.
+ *
+ * @param max_mult Highest baud rate multiplier to try.
+ * @return Multiplier in use, 1 if the baud rate was kept.
+ */
+uint8_t uart16550_upshift(uint8_t max_mult);
+
+// UART16550 instance handle
+
+/** @brief Ring buffer between uart16550_dev_isr() and the non-blocking calls.
+ *
+ * Single-producer/single-consumer: head is only written by the producer and
+ * tail by the consumer; indexes run free and wrap on the ring size.
+ */
+struct uart16550_ring {
+  volatile uint32_t head;                     ///< Producer index.
+  volatile uint32_t tail;                     ///< Consumer index.
+  volatile uint8_t data[UART16550_RING_SIZE]; ///< Ring storage.
+};
+
+/** @brief UART16550 instance statistics (with UART16550_STATS). */
+struct uart16550_stats {
+  uint32_t tx_bytes;  ///< Bytes sent.
+  uint32_t rx_bytes;  ///< Bytes received.
+  uint32_t overrun;   ///< Overrun errors seen in LSR.
+  uint32_t parity;    ///< Parity errors seen in LSR.
+  uint32_t framing;   ///< Framing errors seen in LSR.
+  uint32_t brk;       ///< Break conditions seen in LSR.
+  uint32_t lsr_reads; ///< LSR reads.
+  uint32_t tx_wait;   ///< Busy-wait time for TX (UART16550_STATS_TIME()).
+  uint32_t rx_wait;   ///< Busy-wait time for RX (UART16550_STATS_TIME()).
+};
+
+/** @brief Output buffer of uart16550_bputc(); data[tail..head) is pending. */
+struct uart16550_obuf {
+  uint16_t head;                     ///< End of buffered output.
+  uint16_t tail;                     ///< Start of buffered output.
+  uint8_t data[UART16550_OBUF_SIZE]; ///< Buffer storage.
+};
+
+/** @brief UART16550 instance handle.
+ *
+ * Holds the per-instance state of the driver. Set up with uart16550_dev_init().
+ */
+struct uart16550_dev {
+  int base;                      ///< Instance base address.
+  uint16_t div;                  ///< Baud rate division factor.
+  uint8_t lcr;                   ///< Line control configuration.
+  size_t tx_room;                ///< Free TX FIFO slots known without polling.
+  volatile uint8_t rx_irq_en;    ///< RDA interrupt enabled by ring driver.
+  volatile uint8_t tx_irq_en;    ///< THRE interrupt enabled by ring driver.
+#ifdef UART16550_STATS
+  struct uart16550_stats stats; ///< Transfer statistics.
+#endif
+  struct uart16550_ring tx_ring; ///< Interrupt driven TX ring buffer.
+  struct uart16550_ring rx_ring; ///< Interrupt driven RX ring buffer.
+  struct uart16550_obuf obuf;    ///< Buffered output.
+  char *rx_dst;                  ///< Streamed reception destination.
+  size_t rx_left;                ///< Bytes still to stream to rx_dst.
+};
+
+/** @brief Initialize UART16550 instance.
+ *
+ * Same as uart16550_init() for the instance in dev.
+ *
+ * @param dev Instance handle.
+ * @param base_address IOb-UART16550 instance base address in the system.
+ * @param div Equal to round (fclk/baudrate).
+ * @return void.
+ */
+void uart16550_dev_init(struct uart16550_dev *dev, int base_address,
+                        uint16_t div);
+
+/** @brief Close transmission on instance. See uart16550_finish().
+ *
+ * @param dev Instance handle.
+ * @return void.
+ */
+void uart16550_dev_finish(struct uart16550_dev *dev);
+
+/** @brief Check if TX is ready on instance. See uart16550_txready().
+ *
+ * @param dev Instance handle.
+ * @return TX ready flag
+ */
+char uart16550_dev_txready(struct uart16550_dev *dev);
+
+/** @brief Check if TX FIFO is empty on instance.
+ * See uart16550_txfifo_empty().
+ *
+ * @param dev Instance handle.
+ * @return TX FIFO empty flag
+ */
+char uart16550_dev_txfifo_empty(struct uart16550_dev *dev);
+
+/** @brief Wait for TX on instance. See uart16550_txwait().
+ *
+ * @param dev Instance handle.
+ * @return void.
+ */
+void uart16550_dev_txwait(struct uart16550_dev *dev);
+
+/** @brief Check if RX is ready on instance. See uart16550_rxready().
+ *
+ * @param dev Instance handle.
+ * @return RX ready flag
+ */
+char uart16550_dev_rxready(struct uart16550_dev *dev);
+
+/** @brief Wait for RX data on instance. See uart16550_rxwait().
+ *
+ * @param dev Instance handle.
+ * @return void.
+ */
+void uart16550_dev_rxwait(struct uart16550_dev *dev);
+
+/** @brief Print char on instance. See uart16550_putc().
+ *
+ * @param dev Instance handle.
+ * @param c Character to print.
+ * @return void.
+ */
+void uart16550_dev_putc(struct uart16550_dev *dev, char c);
+
+/** @brief Send buffer on instance. See uart16550_write().
+ *
+ * @param dev Instance handle.
+ * @param buf Pointer to data to send.
+ * @param len Number of bytes to send.
+ * @return void.
+ */
+void uart16550_dev_write(struct uart16550_dev *dev, const void *buf,
+                         size_t len);
+
+/** @brief Print string on instance. See uart16550_puts().
+ *
+ * @param dev Instance handle.
+ * @param s Pointer to char array to be printed.
+ * @return void.
+ */
+void uart16550_dev_puts(struct uart16550_dev *dev, const char *s);
+
+/** @brief Print char through the output buffer of instance.
+ * See uart16550_bputc().
+ *
+ * @param dev Instance handle.
+ * @param c Character to print.
+ * @return void.
+ */
+void uart16550_dev_bputc(struct uart16550_dev *dev, char c);
+
+/** @brief Flush buffered output of instance. See uart16550_flush().
+ *
+ * @param dev Instance handle.
+ * @return void.
+ */
+void uart16550_dev_flush(struct uart16550_dev *dev);
+
+/** @brief Non-blocking flush of buffered output of instance.
+ * See uart16550_flush_nb().
+ *
+ * @param dev Instance handle.
+ * @return Number of bytes still buffered.
+ */
+int uart16550_dev_flush_nb(struct uart16550_dev *dev);
+
+/** @brief Send file on instance. See uart16550_sendfile().
+ *
+ * @param dev Instance handle.
+ * @param file_name Pointer to file name string.
+ * @param file_size Size of file to be sent.
+ * @param mem Pointer to file.
+ * @return void.
+ */
+void uart16550_dev_sendfile(struct uart16550_dev *dev, char *file_name,
+                            int file_size, char *mem);
+
+/** @brief Get char on instance. See uart16550_getc().
+ *
+ * @param dev Instance handle.
+ * @return received byte from UART16550.
+ */
+char uart16550_dev_getc(struct uart16550_dev *dev);
+
+/** @brief Get number of received bytes on instance.
+ * See uart16550_rxcount().
+ *
+ * @param dev Instance handle.
+ * @return Number of bytes waiting in the RX FIFO.
+ */
+size_t uart16550_dev_rxcount(struct uart16550_dev *dev);
+
+/** @brief Receive buffer on instance. See uart16550_read().
+ *
+ * @param dev Instance handle.
+ * @param buf Pointer to store received data.
+ * @param len Number of bytes to receive.
+ * @return void.
+ */
+void uart16550_dev_read(struct uart16550_dev *dev, void *buf, size_t len);
+
+/** @brief Interrupt service routine for instance. See uart16550_isr().
+ *
+ * @param dev Instance handle.
+ * @return void.
+ */
+void uart16550_dev_isr(struct uart16550_dev *dev);
+
+/** @brief Non-blocking print char on instance. See uart16550_putc_nb().
+ *
+ * @param dev Instance handle.
+ * @param c Character to send.
+ * @return 1 if the character was queued, 0 if the TX ring buffer is full.
+ */
+int uart16550_dev_putc_nb(struct uart16550_dev *dev, char c);
+
+/** @brief Non-blocking get char on instance. See uart16550_getc_nb().
+ *
+ * @param dev Instance handle.
+ * @param c Pointer to store the received character.
+ * @return 1 if a character was received, 0 if the RX ring buffer is empty.
+ */
+int uart16550_dev_getc_nb(struct uart16550_dev *dev, char *c);
+
+/** @brief Receive file on instance. See uart16550_recvfile().
+ *
+ * @param dev Instance handle.
+ * @param file_name Pointer to file name string.
+ * @param mem Pointer in memory to store incoming file.
+ * @return Size of received file.
+ */
+int uart16550_dev_recvfile(struct uart16550_dev *dev, char *file_name,
+                           char *mem);
+
+/** @brief Receive file in chunks on instance.
+ * See uart16550_recvfile_stream().
+ *
+ * @param dev Instance handle.
+ * @param file_name Pointer to file name string.
+ * @param buf Pointer to 2 * chunk bytes of reception buffers.
+ * @param chunk Chunk size.
+ * @param cb Chunk consumer.
+ * @param ctx User pointer passed to cb.
+ * @return Size of received file, -1 if the console does not stream files.
+ */
+int uart16550_dev_recvfile_stream(struct uart16550_dev *dev, char *file_name,
+                                  char *buf, size_t chunk,
+                                  uart16550_chunk_cb cb, void *ctx);
+
+/** @brief Keep a streamed file reception going on instance.
+ * See uart16550_stream_poll().
+ *
+ * @param dev Instance handle.
+ * @return Number of bytes still missing from the chunk being received.
+ */
+size_t uart16550_dev_stream_poll(struct uart16550_dev *dev);
+
+#ifdef UART16550_STATS
+/** @brief Get link statistics of instance. See uart16550_get_stats().
+ *
+ * @param dev Instance handle.
+ * @param stats Pointer to store the statistics.
+ * @return void.
+ */
+void uart16550_dev_get_stats(struct uart16550_dev *dev,
+                             struct uart16550_stats *stats);
+
+/** @brief Send link statistics of instance. See uart16550_sendstats().
+ *
+ * @param dev Instance handle.
+ * @return 1 if sent, 0 if the console does not print statistics.
+ */
+int uart16550_dev_sendstats(struct uart16550_dev *dev);
+#endif
+
+/** @brief Negotiate a faster baud rate on instance. See uart16550_upshift().
+ *
+ * @param dev Instance handle.
+ * @param max_mult Highest baud rate multiplier to try.
+ * @return Multiplier in use, 1 if the baud rate was kept.
+ */
+uint8_t uart16550_dev_upshift(struct uart16550_dev *dev, uint8_t max_mult);
+
+#endif // H_IOB_UART16550_H
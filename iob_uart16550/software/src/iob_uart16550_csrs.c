@@ -11,141 +11,379 @@ static inline void set_bit(uint8_t *v, int bit) { *v |= (1 << bit); }
 
 static inline void clr_bit(uint8_t *v, int bit) { *v &= ~(1 << bit); }
 
-// Base Address
-static uint32_t base;
-void iob_uart16550_csrs_init_baseaddr(uint32_t addr) { base = addr; }
+// Backend hook for batches, NULL to replay them through iob_read/iob_write
+static iob_uart16550_csrs_batch_fn batch_fn = 0;
 
-// Core Setters and Getters
-uint8_t iob_uart16550_csrs_get_rb() {
+// Batch shared by the default instances, so their accesses stay in order
+static struct iob_uart16550_csrs_batch batch;
+
+// Default instances of the functions without a handle, one per recently used
+// base address, so alternating between UARTs keeps their shadow LCR
+static struct iob_uart16550_csrs_dev devs[IOB_UART16550_CSRS_LC_SHADOWS] = {
+    {0, 0, 0, 0, &batch}};
+static struct iob_uart16550_csrs_dev *cur = &devs[0];
+static int devs_used = 1;
+static int devs_next = 1 % IOB_UART16550_CSRS_LC_SHADOWS;
+
+void iob_uart16550_csrs_set_batch_fn(iob_uart16550_csrs_batch_fn fn) {
+  batch_fn = fn;
+}
+
+static void batch_submit(struct iob_uart16550_csrs_batch *b) {
+  uint32_t i;
+
+  if (batch_fn) {
+    if (b->len)
+      batch_fn(b->ops, b->len);
+  } else {
+    for (i = 0; i < b->len; i++) {
+      if (b->ops[i].write)
+        iob_write(b->ops[i].addr, b->ops[i].data_w, b->ops[i].value);
+      else
+        b->ops[i].value = iob_read(b->ops[i].addr, b->ops[i].data_w);
+    }
+  }
+  b->len = 0;
+}
+
+static struct iob_uart16550_csrs_op *
+batch_add(struct iob_uart16550_csrs_batch *b, uint32_t addr, uint32_t data_w,
+          uint8_t write, uint32_t value) {
+  struct iob_uart16550_csrs_op *op = &b->ops[b->len++];
+
+  op->addr = addr;
+  op->data_w = data_w;
+  op->value = value;
+  op->write = write;
+  return op;
+}
+
+// CSR access, queued while the instance batch is open
+static void csr_write(struct iob_uart16550_csrs_dev *dev, uint32_t addr,
+                      uint8_t value) {
+  struct iob_uart16550_csrs_batch *b = dev->batch;
+
+  if (!b || !b->depth) {
+    iob_write(dev->base + addr, IOB_UART16550_CSRS_W, value);
+    return;
+  }
+  batch_add(b, dev->base + addr, IOB_UART16550_CSRS_W, 1, value);
+  if (b->len == IOB_UART16550_CSRS_BATCH_SIZE)
+    batch_submit(b);
+}
+
+static uint8_t csr_read(struct iob_uart16550_csrs_dev *dev, uint32_t addr) {
+  struct iob_uart16550_csrs_batch *b = dev->batch;
+  struct iob_uart16550_csrs_op *op;
+
+  if (!b || !b->depth)
+    return iob_read(dev->base + addr, IOB_UART16550_CSRS_W);
+  op = batch_add(b, dev->base + addr, IOB_UART16550_CSRS_W, 0, 0);
+  batch_submit(b);
+  return op->value;
+}
+
+// Shadow LCR: lc is the value in the hardware, dlab its DLAB bit. The divisor
+// latch accessors set DLAB and clear it again, as the LSR, IIR and MSR read
+// side effects and the THR/RBR accesses need it at 0.
+static void lc_load(struct iob_uart16550_csrs_dev *dev) {
+  if (!dev->lc_valid) {
+    dev->lc = csr_read(dev, IOB_UART16550_CSRS_LC_ADDR);
+    dev->dlab = (dev->lc >> IOB_UART16550_LC_DL) & 1;
+    dev->lc_valid = 1;
+  }
+}
+
+// Set LCR bit 7 in hardware to dlab, if not there already
+static void lc_dlab(struct iob_uart16550_csrs_dev *dev, uint8_t dlab) {
+  uint8_t lcr;
+
+  lc_load(dev);
+  if (dev->dlab != dlab) {
+    lcr = dev->lc;
+    if (dlab)
+      set_bit(&lcr, IOB_UART16550_LC_DL);
+    else
+      clr_bit(&lcr, IOB_UART16550_LC_DL);
+    csr_write(dev, IOB_UART16550_CSRS_LC_ADDR, lcr);
+    dev->lc = lcr;
+    dev->dlab = dlab;
+  }
+}
+
+// Instance handle
+void iob_uart16550_csrs_dev_init(struct iob_uart16550_csrs_dev *dev,
+                                 uint32_t addr) {
+  dev->base = addr;
+  dev->lc_valid = 0;
+  dev->batch = 0;
+}
+
+void iob_uart16550_csrs_dev_set_batch(struct iob_uart16550_csrs_dev *dev,
+                                      struct iob_uart16550_csrs_batch *b) {
+  if (b)
+    b->len = b->depth = 0;
+  dev->batch = b;
+}
+
+void iob_uart16550_csrs_dev_batch_begin(struct iob_uart16550_csrs_dev *dev) {
+  if (dev->batch)
+    dev->batch->depth++;
+}
+
+void iob_uart16550_csrs_dev_batch_end(struct iob_uart16550_csrs_dev *dev) {
+  struct iob_uart16550_csrs_batch *b = dev->batch;
+
+  if (b && b->depth && --b->depth == 0)
+    batch_submit(b);
+}
+
+void iob_uart16550_csrs_dev_invalidate_lc(struct iob_uart16550_csrs_dev *dev) {
+  dev->lc_valid = 0;
+}
+
+// Core Setters and Getters on an instance
+uint8_t iob_uart16550_csrs_dev_get_rb(struct iob_uart16550_csrs_dev *dev) {
   // ensure LCR bit 7 is 0
-  uint8_t lcr = iob_uart16550_csrs_get_lc();
-  uint8_t lcr_tmp = lcr;
-  clr_bit(&lcr_tmp, IOB_UART16550_LC_DL);
-  iob_uart16550_csrs_set_lc(lcr_tmp);
+  lc_dlab(dev, 0);
   // read receiver buffer
-  uint8_t rcv_buf =
-      iob_read(base + IOB_UART16550_CSRS_RB_ADDR, IOB_UART16550_CSRS_W);
-  // restore LCR value
-  iob_uart16550_csrs_set_lc(lcr);
-  return rcv_buf;
+  return csr_read(dev, IOB_UART16550_CSRS_RB_ADDR);
 }
 
-void iob_uart16550_csrs_set_tr(uint8_t value) {
+void iob_uart16550_csrs_dev_set_tr(struct iob_uart16550_csrs_dev *dev,
+                                   uint8_t value) {
   // ensure LCR bit 7 is 0
-  uint8_t lcr = iob_uart16550_csrs_get_lc();
-  uint8_t lcr_tmp = lcr;
-  clr_bit(&lcr_tmp, IOB_UART16550_LC_DL);
-  iob_uart16550_csrs_set_lc(lcr_tmp);
+  lc_dlab(dev, 0);
   // write tx buffer
-  iob_write(base + IOB_UART16550_CSRS_TR_ADDR, IOB_UART16550_CSRS_W, value);
-  // restore LCR value
-  iob_uart16550_csrs_set_lc(lcr);
+  csr_write(dev, IOB_UART16550_CSRS_TR_ADDR, value);
 }
 
-uint8_t iob_uart16550_csrs_get_ie() {
+uint8_t iob_uart16550_csrs_dev_get_ie(struct iob_uart16550_csrs_dev *dev) {
   // ensure LCR bit 7 is 0
-  uint8_t lcr = iob_uart16550_csrs_get_lc();
-  uint8_t lcr_tmp = lcr;
-  clr_bit(&lcr_tmp, IOB_UART16550_LC_DL);
-  iob_uart16550_csrs_set_lc(lcr_tmp);
-  uint8_t rcv_buf =
-      iob_read(base + IOB_UART16550_CSRS_IE_ADDR, IOB_UART16550_CSRS_W);
-  // restore LCR value
-  iob_uart16550_csrs_set_lc(lcr);
-  return rcv_buf;
+  lc_dlab(dev, 0);
+  return csr_read(dev, IOB_UART16550_CSRS_IE_ADDR);
 }
 
-void iob_uart16550_csrs_set_ie(uint8_t value) {
+void iob_uart16550_csrs_dev_set_ie(struct iob_uart16550_csrs_dev *dev,
+                                   uint8_t value) {
   // ensure LCR bit 7 is 0
-  uint8_t lcr = iob_uart16550_csrs_get_lc();
-  uint8_t lcr_tmp = lcr;
-  clr_bit(&lcr_tmp, IOB_UART16550_LC_DL);
-  iob_uart16550_csrs_set_lc(lcr_tmp);
-  iob_write(base + IOB_UART16550_CSRS_IE_ADDR, IOB_UART16550_CSRS_W, value);
-  // restore LCR value
-  iob_uart16550_csrs_set_lc(lcr);
+  lc_dlab(dev, 0);
+  csr_write(dev, IOB_UART16550_CSRS_IE_ADDR, value);
+}
+
+uint8_t iob_uart16550_csrs_dev_get_ii(struct iob_uart16550_csrs_dev *dev) {
+  return csr_read(dev, IOB_UART16550_CSRS_II_ADDR);
+}
+
+void iob_uart16550_csrs_dev_set_fc(struct iob_uart16550_csrs_dev *dev,
+                                   uint8_t value) {
+  csr_write(dev, IOB_UART16550_CSRS_FC_ADDR, value);
+}
+
+uint8_t iob_uart16550_csrs_dev_get_lc(struct iob_uart16550_csrs_dev *dev) {
+  lc_load(dev);
+  return dev->lc;
+}
+
+void iob_uart16550_csrs_dev_set_lc(struct iob_uart16550_csrs_dev *dev,
+                                   uint8_t value) {
+  csr_write(dev, IOB_UART16550_CSRS_LC_ADDR, value);
+  dev->lc_valid = 0;
+}
+
+void iob_uart16550_csrs_dev_set_mc(struct iob_uart16550_csrs_dev *dev,
+                                   uint8_t value) {
+  csr_write(dev, IOB_UART16550_CSRS_MC_ADDR, value);
+}
+
+uint8_t iob_uart16550_csrs_dev_get_ls(struct iob_uart16550_csrs_dev *dev) {
+  return csr_read(dev, IOB_UART16550_CSRS_LS_ADDR);
+}
+
+uint8_t iob_uart16550_csrs_dev_get_ms(struct iob_uart16550_csrs_dev *dev) {
+  return csr_read(dev, IOB_UART16550_CSRS_MS_ADDR);
+}
+
+uint8_t iob_uart16550_csrs_dev_get_dl1(struct iob_uart16550_csrs_dev *dev) {
+  uint8_t value;
+
+  // set LCR bit 7 to 1 for the access only
+  lc_dlab(dev, 1);
+  value = csr_read(dev, IOB_UART16550_CSRS_DL1_ADDR);
+  lc_dlab(dev, 0);
+  return value;
+}
+
+void iob_uart16550_csrs_dev_set_dl1(struct iob_uart16550_csrs_dev *dev,
+                                    uint8_t value) {
+  // set LCR bit 7 to 1 for the access only
+  lc_dlab(dev, 1);
+  csr_write(dev, IOB_UART16550_CSRS_DL1_ADDR, value);
+  lc_dlab(dev, 0);
+}
+
+uint8_t iob_uart16550_csrs_dev_get_dl2(struct iob_uart16550_csrs_dev *dev) {
+  uint8_t value;
+
+  // set LCR bit 7 to 1 for the access only
+  lc_dlab(dev, 1);
+  value = csr_read(dev, IOB_UART16550_CSRS_DL2_ADDR);
+  lc_dlab(dev, 0);
+  return value;
+}
+
+void iob_uart16550_csrs_dev_set_dl2(struct iob_uart16550_csrs_dev *dev,
+                                    uint8_t value) {
+  // set LCR bit 7 to 1 for the access only
+  lc_dlab(dev, 1);
+  csr_write(dev, IOB_UART16550_CSRS_DL2_ADDR, value);
+  lc_dlab(dev, 0);
+}
+
+uint8_t iob_uart16550_csrs_dev_get_db1(struct iob_uart16550_csrs_dev *dev) {
+  return csr_read(dev, IOB_UART16550_CSRS_DB1_ADDR);
+}
+
+uint8_t iob_uart16550_csrs_dev_get_db2(struct iob_uart16550_csrs_dev *dev) {
+  return csr_read(dev, IOB_UART16550_CSRS_DB2_ADDR);
+}
+
+// Status snapshot
+void iob_uart16550_snapshot_decode(uint32_t db1, uint32_t db2,
+                                   struct iob_uart16550_snapshot *s) {
+  // db1: {msr, lcr, iir, ier, lsr}
+  s->lsr = db1 & 0xFF;
+  s->ier = (db1 >> 8) & 0xF;
+  s->iir = (db1 >> 12) & 0xF;
+  s->lcr = (db1 >> 16) & 0xFF;
+  s->msr = (db1 >> 24) & 0xFF;
+  // db2: {fcr[7:6], mcr, rf_count, rstate, tf_count, tstate}
+  s->tstate = db2 & 0x7;
+  s->tf_count = (db2 >> 3) & 0x1FF;
+  s->rstate = (db2 >> 12) & 0xF;
+  s->rf_count = (db2 >> 16) & 0x1FF;
+  s->mcr = (db2 >> 25) & 0x1F;
+  s->fcr = ((db2 >> 30) & 0x3) << IOB_UART16550_FC_TL;
+}
+
+void iob_uart16550_csrs_dev_snapshot(struct iob_uart16550_csrs_dev *dev,
+                                     struct iob_uart16550_snapshot *s) {
+  struct iob_uart16550_csrs_batch *b = dev->batch;
+  struct iob_uart16550_csrs_op *db1, *db2;
+
+  if (!b || !b->depth) {
+    iob_uart16550_snapshot_decode(
+        iob_read(dev->base + IOB_UART16550_CSRS_DB1_ADDR, 32),
+        iob_read(dev->base + IOB_UART16550_CSRS_DB2_ADDR, 32), s);
+    return;
+  }
+  // both reads in the same submission
+  if (b->len > IOB_UART16550_CSRS_BATCH_SIZE - 2)
+    batch_submit(b);
+  db1 = batch_add(b, dev->base + IOB_UART16550_CSRS_DB1_ADDR, 32, 0, 0);
+  db2 = batch_add(b, dev->base + IOB_UART16550_CSRS_DB2_ADDR, 32, 0, 0);
+  batch_submit(b);
+  iob_uart16550_snapshot_decode(db1->value, db2->value, s);
+}
+
+// Base Address
+void iob_uart16550_csrs_init_baseaddr(uint32_t addr) {
+  int i;
+
+  for (i = 0; i < devs_used; i++) {
+    if (devs[i].base == addr) {
+      cur = &devs[i];
+      return;
+    }
+  }
+  cur = &devs[devs_next];
+  devs_next = (devs_next + 1) % IOB_UART16550_CSRS_LC_SHADOWS;
+  if (devs_used < IOB_UART16550_CSRS_LC_SHADOWS)
+    devs_used++;
+  iob_uart16550_csrs_dev_init(cur, addr);
+  cur->batch = &batch;
+}
+
+void iob_uart16550_csrs_invalidate_lc() {
+  iob_uart16550_csrs_dev_invalidate_lc(cur);
+}
+
+void iob_uart16550_csrs_batch_begin() { batch.depth++; }
+
+void iob_uart16550_csrs_batch_end() {
+  if (batch.depth && --batch.depth == 0)
+    batch_submit(&batch);
+}
+
+// Core Setters and Getters on the default instance
+uint8_t iob_uart16550_csrs_get_rb() {
+  return iob_uart16550_csrs_dev_get_rb(cur);
+}
+
+void iob_uart16550_csrs_set_tr(uint8_t value) {
+  iob_uart16550_csrs_dev_set_tr(cur, value);
+}
+
+uint8_t iob_uart16550_csrs_get_ie() {
+  return iob_uart16550_csrs_dev_get_ie(cur);
+}
+
+void iob_uart16550_csrs_set_ie(uint8_t value) {
+  iob_uart16550_csrs_dev_set_ie(cur, value);
 }
 
 uint8_t iob_uart16550_csrs_get_ii() {
-  return iob_read(base + IOB_UART16550_CSRS_II_ADDR, IOB_UART16550_CSRS_W);
+  return iob_uart16550_csrs_dev_get_ii(cur);
 }
 
 void iob_uart16550_csrs_set_fc(uint8_t value) {
-  iob_write(base + IOB_UART16550_CSRS_FC_ADDR, IOB_UART16550_CSRS_W, value);
+  iob_uart16550_csrs_dev_set_fc(cur, value);
 }
 
 uint8_t iob_uart16550_csrs_get_lc() {
-  return iob_read(base + IOB_UART16550_CSRS_LC_ADDR, IOB_UART16550_CSRS_W);
+  return iob_uart16550_csrs_dev_get_lc(cur);
 }
 
 void iob_uart16550_csrs_set_lc(uint8_t value) {
-  iob_write(base + IOB_UART16550_CSRS_LC_ADDR, IOB_UART16550_CSRS_W, value);
+  iob_uart16550_csrs_dev_set_lc(cur, value);
 }
 
 void iob_uart16550_csrs_set_mc(uint8_t value) {
-  iob_write(base + IOB_UART16550_CSRS_MC_ADDR, IOB_UART16550_CSRS_W, value);
+  iob_uart16550_csrs_dev_set_mc(cur, value);
 }
 
 uint8_t iob_uart16550_csrs_get_ls() {
-  return iob_read(base + IOB_UART16550_CSRS_LS_ADDR, IOB_UART16550_CSRS_W);
+  return iob_uart16550_csrs_dev_get_ls(cur);
 }
 
 uint8_t iob_uart16550_csrs_get_ms() {
-  return iob_read(base + IOB_UART16550_CSRS_MS_ADDR, IOB_UART16550_CSRS_W);
+  return iob_uart16550_csrs_dev_get_ms(cur);
 }
 
 uint8_t iob_uart16550_csrs_get_dl1() {
-  // ensure LCR bit 7 is 1
-  uint8_t lcr = iob_uart16550_csrs_get_lc();
-  uint8_t lcr_tmp = lcr;
-  set_bit(&lcr_tmp, IOB_UART16550_LC_DL);
-  iob_uart16550_csrs_set_lc(lcr_tmp);
-  uint8_t div_latch1 =
-      iob_read(base + IOB_UART16550_CSRS_DL1_ADDR, IOB_UART16550_CSRS_W);
-  // restore LCR value
-  iob_uart16550_csrs_set_lc(lcr);
-  return div_latch1;
+  return iob_uart16550_csrs_dev_get_dl1(cur);
 }
 
 void iob_uart16550_csrs_set_dl1(uint8_t value) {
-  // ensure LCR bit 7 is 1
-  uint8_t lcr = iob_uart16550_csrs_get_lc();
-  uint8_t lcr_tmp = lcr;
-  set_bit(&lcr_tmp, IOB_UART16550_LC_DL);
-  iob_uart16550_csrs_set_lc(lcr_tmp);
-  iob_write(base + IOB_UART16550_CSRS_DL1_ADDR, IOB_UART16550_CSRS_W, value);
-  // restore LCR value
-  iob_uart16550_csrs_set_lc(lcr);
+  iob_uart16550_csrs_dev_set_dl1(cur, value);
 }
 
 uint8_t iob_uart16550_csrs_get_dl2() {
-  // ensure LCR bit 7 is 1
-  uint8_t lcr = iob_uart16550_csrs_get_lc();
-  uint8_t lcr_tmp = lcr;
-  set_bit(&lcr_tmp, IOB_UART16550_LC_DL);
-  iob_uart16550_csrs_set_lc(lcr_tmp);
-  uint8_t div_latch2 =
-      iob_read(base + IOB_UART16550_CSRS_DL2_ADDR, IOB_UART16550_CSRS_W);
-  // restore LCR value
-  iob_uart16550_csrs_set_lc(lcr);
-  return div_latch2;
+  return iob_uart16550_csrs_dev_get_dl2(cur);
 }
 
 void iob_uart16550_csrs_set_dl2(uint8_t value) {
-  // ensure LCR bit 7 is 1
-  uint8_t lcr = iob_uart16550_csrs_get_lc();
-  uint8_t lcr_tmp = lcr;
-  set_bit(&lcr_tmp, IOB_UART16550_LC_DL);
-  iob_uart16550_csrs_set_lc(lcr_tmp);
-  iob_write(base + IOB_UART16550_CSRS_DL2_ADDR, IOB_UART16550_CSRS_W, value);
-  // restore LCR value
-  iob_uart16550_csrs_set_lc(lcr);
+  iob_uart16550_csrs_dev_set_dl2(cur, value);
 }
 
 uint8_t iob_uart16550_csrs_get_db1() {
-  return iob_read(base + IOB_UART16550_CSRS_DB1_ADDR, IOB_UART16550_CSRS_W);
+  return iob_uart16550_csrs_dev_get_db1(cur);
 }
 
 uint8_t iob_uart16550_csrs_get_db2() {
-  return iob_read(base + IOB_UART16550_CSRS_DB2_ADDR, IOB_UART16550_CSRS_W);
+  return iob_uart16550_csrs_dev_get_db2(cur);
+}
+
+void iob_uart16550_snapshot(struct iob_uart16550_snapshot *s) {
+  iob_uart16550_csrs_dev_snapshot(cur, s);
 }
@@ -10,6 +10,13 @@
  * The present IOb-UART16550 software drivers map the Control and Status
  * Registers for direct core access.
  *
+ * Every accessor has an `iob_uart16550_csrs_dev_` variant that takes an
+ * instance handle and keeps no global state, so instances can be driven from
+ * several threads at once, as long as iob_read() and iob_write() are
+ * thread-safe and each handle and batch is used by a single thread. The
+ * accessors without a handle act on the instance selected by
+ * iob_uart16550_csrs_init_baseaddr().
+ *
  */
 
 #ifndef H_IOB_UART16550_CSRS_CSRS_H
@@ -344,6 +351,14 @@
  */
 #define IOB_UART16550_CSRS_W 8
 
+/**
+ * @def IOB_UART16550_CSRS_LC_SHADOWS
+ * @brief Number of base addresses whose LCR is shadowed.
+ */
+#ifndef IOB_UART16550_CSRS_LC_SHADOWS
+#define IOB_UART16550_CSRS_LC_SHADOWS 4
+#endif
+
 // Base Address
 /**
  * @brief Set core base address.
@@ -351,10 +366,105 @@
  * This function sets the base address for the core in the system. All other
  * accesses are offset from this base address.
  *
+ * A shadow copy of LCR is kept for the last IOB_UART16550_CSRS_LC_SHADOWS base
+ * addresses, so the accessors that depend on the divisor latch access bit
+ * (DLAB) write LCR only when DLAB must change. The divisor latch accessors set
+ * DLAB and clear it again, so that it is 0 for all other accesses; get_lc()
+ * returns the value in the hardware.
+ *
  * @param addr Base address for core.
  */
 void iob_uart16550_csrs_init_baseaddr(uint32_t addr);
 
+/**
+ * @brief Invalidate the shadow LCR of the current base address.
+ *
+ * Call it after LCR is written other than through this layer.
+ */
+void iob_uart16550_csrs_invalidate_lc();
+
+/**
+ * @def IOB_UART16550_CSRS_BATCH_SIZE
+ * @brief Maximum number of CSR accesses submitted in one batch.
+ */
+#ifndef IOB_UART16550_CSRS_BATCH_SIZE
+#define IOB_UART16550_CSRS_BATCH_SIZE 16
+#endif
+
+// Batched accesses
+/**
+ * @brief One CSR access of a batch.
+ *
+ * The backend performs the accesses in order; for reads it stores the data
+ * read in value.
+ */
+struct iob_uart16550_csrs_op {
+  uint32_t addr;   ///< Absolute address.
+  uint32_t data_w; ///< Data width in bits.
+  uint32_t value;  ///< Data to write, or data read.
+  uint8_t write;   ///< 1 for a write, 0 for a read.
+};
+
+/**
+ * @brief Backend hook that performs a batch of CSR accesses.
+ *
+ * @param ops Accesses to perform, in order.
+ * @param n Number of accesses.
+ */
+typedef void (*iob_uart16550_csrs_batch_fn)(struct iob_uart16550_csrs_op *ops,
+                                            uint32_t n);
+
+/**
+ * @brief Queue of batched CSR accesses.
+ *
+ * Attached to instance handles with iob_uart16550_csrs_dev_set_batch(); the
+ * handles sharing a batch keep their accesses in order.
+ */
+struct iob_uart16550_csrs_batch {
+  struct iob_uart16550_csrs_op ops[IOB_UART16550_CSRS_BATCH_SIZE]; ///< Queue.
+  uint32_t len; ///< Number of queued accesses.
+  int depth;    ///< Nesting level of open batches, 0 when not recording.
+};
+
+/**
+ * @brief UART16550 CSRs instance handle.
+ *
+ * Holds the base address and shadow LCR of an instance. Set up with
+ * iob_uart16550_csrs_dev_init().
+ */
+struct iob_uart16550_csrs_dev {
+  uint32_t base;                          ///< Instance base address.
+  uint8_t lc_valid;                       ///< Shadow LCR is valid.
+  uint8_t lc;                             ///< Shadow LCR, as in the hardware.
+  uint8_t dlab;                           ///< DLAB currently in the hardware.
+  struct iob_uart16550_csrs_batch *batch; ///< Batch queue, or NULL.
+};
+
+/**
+ * @brief Set the backend hook for batched accesses.
+ *
+ * For backends where each access is a round trip (testbench transports,
+ * syscalls). With no hook (NULL, the default) batches are replayed one access
+ * at a time through iob_read() and iob_write().
+ *
+ * @param fn Backend hook, or NULL.
+ */
+void iob_uart16550_csrs_set_batch_fn(iob_uart16550_csrs_batch_fn fn);
+
+/**
+ * @brief Start recording CSR accesses.
+ *
+ * Until the matching iob_uart16550_csrs_batch_end(), writes made through this
+ * layer are queued. A read submits the queue together with itself, since its
+ * value is needed at once; a full queue is submitted as well. Calls nest.
+ */
+void iob_uart16550_csrs_batch_begin();
+
+/**
+ * @brief Stop recording and submit the queued CSR accesses.
+ */
+void iob_uart16550_csrs_batch_end();
+
 // IO read and write function prototypes
 /**
  * @brief Write access function prototype.
@@ -412,13 +522,13 @@ uint8_t iob_uart16550_csrs_get_ii();
 void iob_uart16550_csrs_set_fc(uint8_t value);
 /**
  * @brief Get Line control.
- * Line control
+ * Line control, from the shadow copy when valid
  * @return uint8_t current Line control.
  */
 uint8_t iob_uart16550_csrs_get_lc();
 /**
  * @brief Set Line control.
- * Line control
+ * Line control; invalidates the shadow copy
  * @param value for Line control.
  */
 void iob_uart16550_csrs_set_lc(uint8_t value);
@@ -477,4 +587,209 @@ uint8_t iob_uart16550_csrs_get_db1();
  */
 uint8_t iob_uart16550_csrs_get_db2();
 
+// Instance handle
+/**
+ * @brief Initialize an instance handle.
+ *
+ * Same as iob_uart16550_csrs_init_baseaddr() for the instance in dev. The
+ * handle starts with no batch attached.
+ *
+ * @param dev Instance handle.
+ * @param addr Base address for core.
+ */
+void iob_uart16550_csrs_dev_init(struct iob_uart16550_csrs_dev *dev,
+                                 uint32_t addr);
+/**
+ * @brief Attach a batch queue to an instance handle.
+ *
+ * The queue is reset. See iob_uart16550_csrs_batch_begin().
+ *
+ * @param dev Instance handle.
+ * @param b Batch queue, or NULL to access the CSRs directly.
+ */
+void iob_uart16550_csrs_dev_set_batch(struct iob_uart16550_csrs_dev *dev,
+                                      struct iob_uart16550_csrs_batch *b);
+/**
+ * @brief Start recording on the batch of an instance.
+ * See iob_uart16550_csrs_batch_begin().
+ * @param dev Instance handle.
+ */
+void iob_uart16550_csrs_dev_batch_begin(struct iob_uart16550_csrs_dev *dev);
+/**
+ * @brief Submit the batch of an instance.
+ * See iob_uart16550_csrs_batch_end().
+ * @param dev Instance handle.
+ */
+void iob_uart16550_csrs_dev_batch_end(struct iob_uart16550_csrs_dev *dev);
+/**
+ * @brief Invalidate the shadow LCR of an instance.
+ * See iob_uart16550_csrs_invalidate_lc().
+ * @param dev Instance handle.
+ */
+void iob_uart16550_csrs_dev_invalidate_lc(struct iob_uart16550_csrs_dev *dev);
+
+// Core Setters and Getters on an instance
+/**
+ * @brief Get receiver buffer. See iob_uart16550_csrs_get_rb().
+ * @param dev Instance handle.
+ * @return uint8_t receiver buffer value.
+ */
+uint8_t iob_uart16550_csrs_dev_get_rb(struct iob_uart16550_csrs_dev *dev);
+/**
+ * @brief Write to transmitter buffer. See iob_uart16550_csrs_set_tr().
+ * @param dev Instance handle.
+ * @param value to write to tx buffer.
+ */
+void iob_uart16550_csrs_dev_set_tr(struct iob_uart16550_csrs_dev *dev,
+                                   uint8_t value);
+/**
+ * @brief Get interrupt enable. See iob_uart16550_csrs_get_ie().
+ * @param dev Instance handle.
+ * @return uint8_t interrupt enable value.
+ */
+uint8_t iob_uart16550_csrs_dev_get_ie(struct iob_uart16550_csrs_dev *dev);
+/**
+ * @brief Set interrupt enable. See iob_uart16550_csrs_set_ie().
+ * @param dev Instance handle.
+ * @param value for interrupt enable.
+ */
+void iob_uart16550_csrs_dev_set_ie(struct iob_uart16550_csrs_dev *dev,
+                                   uint8_t value);
+/**
+ * @brief Get interrupt identification. See iob_uart16550_csrs_get_ii().
+ * @param dev Instance handle.
+ * @return uint8_t interrupt identification.
+ */
+uint8_t iob_uart16550_csrs_dev_get_ii(struct iob_uart16550_csrs_dev *dev);
+/**
+ * @brief Set FIFO control. See iob_uart16550_csrs_set_fc().
+ * @param dev Instance handle.
+ * @param value FIFO control.
+ */
+void iob_uart16550_csrs_dev_set_fc(struct iob_uart16550_csrs_dev *dev,
+                                   uint8_t value);
+/**
+ * @brief Get Line control. See iob_uart16550_csrs_get_lc().
+ * @param dev Instance handle.
+ * @return uint8_t current Line control.
+ */
+uint8_t iob_uart16550_csrs_dev_get_lc(struct iob_uart16550_csrs_dev *dev);
+/**
+ * @brief Set Line control. See iob_uart16550_csrs_set_lc().
+ * @param dev Instance handle.
+ * @param value for Line control.
+ */
+void iob_uart16550_csrs_dev_set_lc(struct iob_uart16550_csrs_dev *dev,
+                                   uint8_t value);
+/**
+ * @brief Set Modem control. See iob_uart16550_csrs_set_mc().
+ * @param dev Instance handle.
+ * @param value for Modem control.
+ */
+void iob_uart16550_csrs_dev_set_mc(struct iob_uart16550_csrs_dev *dev,
+                                   uint8_t value);
+/**
+ * @brief Get Line status. See iob_uart16550_csrs_get_ls().
+ * @param dev Instance handle.
+ * @return uint8_t Line status.
+ */
+uint8_t iob_uart16550_csrs_dev_get_ls(struct iob_uart16550_csrs_dev *dev);
+/**
+ * @brief Get Modem status. See iob_uart16550_csrs_get_ms().
+ * @param dev Instance handle.
+ * @return uint8_t Modem status.
+ */
+uint8_t iob_uart16550_csrs_dev_get_ms(struct iob_uart16550_csrs_dev *dev);
+/**
+ * @brief Get Divisor latch bytes (1). See iob_uart16550_csrs_get_dl1().
+ * @param dev Instance handle.
+ * @return uint8_t Divisor latch bytes (1).
+ */
+uint8_t iob_uart16550_csrs_dev_get_dl1(struct iob_uart16550_csrs_dev *dev);
+/**
+ * @brief Set Divisor latch bytes (1). See iob_uart16550_csrs_set_dl1().
+ * @param dev Instance handle.
+ * @param value for Divisor latch bytes (1).
+ */
+void iob_uart16550_csrs_dev_set_dl1(struct iob_uart16550_csrs_dev *dev,
+                                    uint8_t value);
+/**
+ * @brief Get Divisor latch bytes (2). See iob_uart16550_csrs_get_dl2().
+ * @param dev Instance handle.
+ * @return uint8_t Divisor latch bytes (2).
+ */
+uint8_t iob_uart16550_csrs_dev_get_dl2(struct iob_uart16550_csrs_dev *dev);
+/**
+ * @brief Set Divisor latch bytes (2). See iob_uart16550_csrs_set_dl2().
+ * @param dev Instance handle.
+ * @param value for Divisor latch bytes (2).
+ */
+void iob_uart16550_csrs_dev_set_dl2(struct iob_uart16550_csrs_dev *dev,
+                                    uint8_t value);
+/**
+ * @brief Get Debug register 1. See iob_uart16550_csrs_get_db1().
+ * @param dev Instance handle.
+ * @return uint8_t Debug register 1.
+ */
+uint8_t iob_uart16550_csrs_dev_get_db1(struct iob_uart16550_csrs_dev *dev);
+/**
+ * @brief Get Debug register 2. See iob_uart16550_csrs_get_db2().
+ * @param dev Instance handle.
+ * @return uint8_t Debug register 2.
+ */
+uint8_t iob_uart16550_csrs_dev_get_db2(struct iob_uart16550_csrs_dev *dev);
+
+// Status snapshot
+/**
+ * @brief UART16550 state decoded from the 32-bit debug registers.
+ *
+ * Debug register 1 holds {msr, lcr, iir, ier, lsr} and debug register 2
+ * {fcr[7:6], mcr, rf_count, rstate, tf_count, tstate}. Reading them has no side
+ * effects: LSR error bits and the THRE interrupt are not cleared.
+ */
+struct iob_uart16550_snapshot {
+  uint8_t lsr;       ///< Line status.
+  uint8_t ier;       ///< Interrupt enable (bits 3:0).
+  uint8_t iir;       ///< Interrupt identification (bits 3:0).
+  uint8_t lcr;       ///< Line control, including DLAB.
+  uint8_t msr;       ///< Modem status.
+  uint8_t fcr;       ///< FIFO control trigger level (bits 7:6).
+  uint8_t mcr;       ///< Modem control (bits 4:0).
+  uint8_t tstate;    ///< Transmitter state machine.
+  uint8_t rstate;    ///< Receiver state machine.
+  uint16_t tf_count; ///< Bytes in the TX FIFO.
+  uint16_t rf_count; ///< Bytes in the RX FIFO.
+};
+
+/**
+ * @brief Decode the debug register words into a snapshot.
+ *
+ * For code that reads the two words itself.
+ *
+ * @param db1 Debug register 1 (32-bit).
+ * @param db2 Debug register 2 (32-bit).
+ * @param s Decoded state.
+ */
+void iob_uart16550_snapshot_decode(uint32_t db1, uint32_t db2,
+                                   struct iob_uart16550_snapshot *s);
+
+/**
+ * @brief Sample the UART state.
+ *
+ * Two 32-bit reads of the debug registers, in place of a read per register
+ * and the LCR accesses around them. Within a batch both reads go in one
+ * submission.
+ *
+ * @param s Decoded state.
+ */
+void iob_uart16550_snapshot(struct iob_uart16550_snapshot *s);
+
+/**
+ * @brief Sample the state of an instance. See iob_uart16550_snapshot().
+ * @param dev Instance handle.
+ * @param s Decoded state.
+ */
+void iob_uart16550_csrs_dev_snapshot(struct iob_uart16550_csrs_dev *dev,
+                                     struct iob_uart16550_snapshot *s);
+
 #endif // H_IOB_UART16550_CSRS__CSRS_H
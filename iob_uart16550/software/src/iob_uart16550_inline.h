@@ -0,0 +1,178 @@
+/*
+ * SPDX-FileCopyrightText: 2025 IObundle
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/** @file iob_uart16550_inline.h
+ *  @brief Header-only iob_uart16550 functions for fixed-address instances
+ *
+ * Inline variant of the iob_uart16550 drivers for systems where the UART16550
+ * base address is known at compile time. Every function takes the base address
+ * as its first argument; when it is a constant (for example `UART16550_BASE`)
+ * the register addresses fold into immediates and each register access becomes
+ * a single load or store instruction. No global state is kept, so several
+ * fixed-address instances can be used side by side.
+ *
+ * The register stride and access width default to the IOb-UART16550 layout
+ * (byte registers at consecutive byte addresses) and can be overridden before
+ * including this file, for UARTs behind bridges that place each register on a
+ * wider slot.
+ *
+ */
+
+#ifndef H_IOB_UART16550_INLINE_H
+#define H_IOB_UART16550_INLINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "iob_uart16550.h"
+#include "iob_uart16550_conf.h"
+
+/**
+ * @def IOB_UART16550_INLINE_STRIDE
+ * @brief Distance in bytes between consecutive UART16550 registers.
+ */
+#ifndef IOB_UART16550_INLINE_STRIDE
+#define IOB_UART16550_INLINE_STRIDE 1
+#endif
+
+/**
+ * @def IOB_UART16550_INLINE_ACCESS_W
+ * @brief Width in bits of the 8-bit register accesses (8, 16 or 32).
+ */
+#ifndef IOB_UART16550_INLINE_ACCESS_W
+#define IOB_UART16550_INLINE_ACCESS_W 8
+#endif
+
+// rxcount and putc read the 32-bit debug interface
+#if (IOB_UART16550_DATA_W != 32)
+#error "iob_uart16550_inline.h requires IOB_UART16550_DATA_W == 32"
+#endif
+
+#if (IOB_UART16550_INLINE_ACCESS_W == 32)
+typedef uint32_t uart16550_inl_reg_t;
+#elif (IOB_UART16550_INLINE_ACCESS_W == 16)
+typedef uint16_t uart16550_inl_reg_t;
+#else
+typedef uint8_t uart16550_inl_reg_t;
+#endif
+
+/**
+ * @def UART16550_INL_REG
+ * @brief UART16550 register n of the instance at base.
+ */
+#define UART16550_INL_REG(base, n)                                             \
+  (*((volatile uart16550_inl_reg_t *)((uintptr_t)(base) +                      \
+                                      (n) * IOB_UART16550_INLINE_STRIDE)))
+
+/**
+ * @def UART16550_INL_DB2
+ * @brief 32-bit debug register 2 of the instance at base.
+ */
+#define UART16550_INL_DB2(base)                                                \
+  (*((volatile uint32_t *)((uintptr_t)(base) +                                 \
+                           12 * IOB_UART16550_INLINE_STRIDE)))
+
+#define UART16550_INL __attribute__((always_inline)) static inline
+
+/** @brief Check if TX is ready. See uart16550_txready(). */
+UART16550_INL char uart16550_inl_txready(uintptr_t base) {
+  return UART16550_INL_REG(base, 5) & (0x01 << 6);
+}
+
+/** @brief Wait for TX. See uart16550_txwait(). */
+UART16550_INL void uart16550_inl_txwait(uintptr_t base) {
+  while (!uart16550_inl_txready(base))
+    ;
+}
+
+/** @brief Check if RX is ready. See uart16550_rxready(). */
+UART16550_INL char uart16550_inl_rxready(uintptr_t base) {
+  return UART16550_INL_REG(base, 5) & 0x01;
+}
+
+/** @brief Wait for RX data. See uart16550_rxwait(). */
+UART16550_INL void uart16550_inl_rxwait(uintptr_t base) {
+  while (!uart16550_inl_rxready(base))
+    ;
+}
+
+/** @brief Get number of received bytes. See uart16550_rxcount(). */
+UART16550_INL size_t uart16550_inl_rxcount(uintptr_t base) {
+  return (UART16550_INL_DB2(base) >> 16) & 0x1FF;
+}
+
+/** @brief Print char.
+ *
+ * Waits only while the TX FIFO is full (tf_count in debug register 2), so
+ * consecutive calls keep the FIFO filled.
+ */
+UART16550_INL void uart16550_inl_putc(uintptr_t base, char c) {
+  while (((UART16550_INL_DB2(base) >> 3) & 0x1FF) >= UART16550_FIFO_DEPTH)
+    ;
+  UART16550_INL_REG(base, 0) = (uint8_t)c;
+}
+
+/** @brief Get char. See uart16550_getc(). */
+UART16550_INL char uart16550_inl_getc(uintptr_t base) {
+  uart16550_inl_rxwait(base);
+  return (char)UART16550_INL_REG(base, 0);
+}
+
+/** @brief Send buffer. See uart16550_write(). */
+UART16550_INL void uart16550_inl_write(uintptr_t base, const void *buf,
+                                       size_t len) {
+  const uint8_t *p = (const uint8_t *)buf;
+  size_t n;
+
+  while (len) {
+    while (!(UART16550_INL_REG(base, 5) & (0x01 << 5)))
+      ;
+    n = (len < UART16550_FIFO_DEPTH) ? len : UART16550_FIFO_DEPTH;
+    len -= n;
+    while (n--)
+      UART16550_INL_REG(base, 0) = *p++;
+  }
+}
+
+/** @brief Receive buffer. See uart16550_read(). */
+UART16550_INL void uart16550_inl_read(uintptr_t base, void *buf, size_t len) {
+  uint8_t *p = (uint8_t *)buf;
+  size_t n;
+
+  while (len) {
+    n = uart16550_inl_rxcount(base);
+    if (n > len)
+      n = len;
+    len -= n;
+    while (n--)
+      *p++ = UART16550_INL_REG(base, 0);
+  }
+}
+
+/** @brief Initialize UART16550. See uart16550_init(). */
+UART16550_INL void uart16550_inl_init(uintptr_t base, uint16_t div) {
+  uint8_t lcr = UART16550_INL_REG(base, 3);
+
+  // Divisor latches are accessed with LCR bit 7 set
+  UART16550_INL_REG(base, 3) = lcr | 0x80;
+  UART16550_INL_REG(base, 1) = (uint8_t)(div >> 8);
+  UART16550_INL_REG(base, 0) = (uint8_t)div;
+  UART16550_INL_REG(base, 3) = lcr & 0x7F;
+  // FIFO trigger level: 14 bytes
+  UART16550_INL_REG(base, 2) = 0xC0;
+  // RDA and THRE interrupts
+  UART16550_INL_REG(base, 1) = 0x03;
+}
+
+/** @brief Close transmission. See uart16550_finish(). */
+UART16550_INL void uart16550_inl_finish(uintptr_t base) {
+  uart16550_inl_putc(base, EOT);
+  uart16550_inl_txwait(base);
+}
+
+#undef UART16550_INL
+
+#endif // H_IOB_UART16550_INLINE_H
@@ -4,6 +4,14 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
 #include <verilated.h>
 #if (VM_TRACE == 1) // If verilator was invoked with --trace
 #if (VM_TRACE_FST == 1)
@@ -13,7 +21,13 @@
 #endif
 #endif
 
+#ifdef VLT_SAVABLE // If verilator was invoked with --savable
+#include <verilated_save.h>
+#endif
+
 #include "Viob_uut.h" //user file that defins the dut
+#include "iob_tb_services.h"
+#include "iob_uart16550_csrs.h"
 
 #ifndef CLK_PERIOD
 #define FREQ 100000000
@@ -23,43 +37,474 @@
 #if (VM_TRACE == 1)
 #if (VM_TRACE_FST == 1)
 VerilatedFstC *tfp = new VerilatedFstC; // Create tracing object
+#define TRACE_FILE "uut.fst"
 #else
 VerilatedVcdC *tfp = new VerilatedVcdC; // Create tracing object
+#define TRACE_FILE "uut.vcd"
 #endif
 #endif
 
 // simulation time
 vluint64_t sim_time = 0;
 
-// Delayed start time of VCD trace dump
-// Used to avoid large VCD dump files during long simulations
+// Trace window [trace_start, trace_stop) in simulation time, to avoid large
+// dump files during long simulations. Set by plusargs:
+//   +trace_start=<time> +trace_stop=<time>              by simulation time
+//   +trace_start_cycle=<n> +trace_stop_cycle=<n>        by clock cycle
+//   +trace_addr=<addr>    start on a bus access to addr
+//   +trace_on_error       start on an LSR read with an error bit set
+//   +trace_on_fail        start when the core testbench reports a failure
+//   +trace_post=<n>       with a trigger, stop n cycles after it
+// With a trigger and no start, tracing waits for the trigger.
 #if (VM_TRACE == 1)
-vluint64_t vcd_delayed_start = 0;
+vluint64_t trace_start = 0;
+vluint64_t trace_stop = ~0ULL;
+vluint64_t trace_post = 0;
+unsigned int trace_addr = ~0U;
+bool trace_on_error = false;
+bool trace_on_fail = false;
 #endif
 
 Viob_uut *dut = new Viob_uut; // Create instance of module
 
+// Bus transactions issued by the core testbench
+unsigned int bus_transactions = 0;
+
+// Maximum clock cycles iob_wait_irq() sleeps
+#define IRQ_TIMEOUT 1000000
+
 int iob_core_tb();
 
-// Clock tick
-void clk_tick(unsigned int n = 1) {
-  for (unsigned int i = 0; i < n; i++) {
-    dut->eval();
+// Simulated clock cycles, for the rate report
+vluint64_t sim_cycles = 0;
+
+// Bit-level RS232 transceiver on the line pins of iob_uut. It drives the RX
+// of UART16550 #1 from a host buffer and decodes its TX into another, so line
+// rate traffic needs no bus transactions. The frame format is given as LCR
+// bits [5:0]; 1.5 stop bits (5-bit characters) are sent as 2.
+class Rs232Line {
+public:
+  bool enabled = false;
+
+  // cycles_per_bit is 16 * the UART16550 divisor; 0 disables the model
+  void config(unsigned int cycles_per_bit, unsigned int lcr, unsigned int gap) {
+    cpb = cycles_per_bit;
+    bits = 5 + (lcr & 0x3);
+    parity = (lcr >> 3) & 0x1;
+    even = (lcr >> 4) & 0x1;
+    stick = (lcr >> 5) & 0x1;
+    stops = ((lcr >> 2) & 0x1) ? 2 : 1;
+    gap_cycles = gap;
+    tx.clear();
+    rx.clear();
+    tx_nbits = tx_cnt = tx_gap = rx_nbits = 0;
+    rx_prev = 1;
+    enabled = cpb != 0;
+    dut->line_rxd_i = 1;
+    dut->line_en_i = enabled;
+  }
+
+  void send(const uint8_t *buf, size_t len) {
+    tx.insert(tx.end(), buf, buf + len);
+  }
+
+  size_t recv(uint8_t *buf, size_t len) {
+    size_t n = 0;
+
+    for (; n < len && !rx.empty(); n++) {
+      buf[n] = rx.front();
+      rx.pop_front();
+    }
+    return n;
+  }
+
+  // Characters still to send, including the one on the line
+  size_t pending() { return tx.size() + (tx_nbits != 0); }
+
+  // Advance one clock cycle
+  void tick() {
+    tx_tick();
+    rx_tick();
+  }
+
+private:
+  unsigned int cpb = 0, bits = 8, parity = 0, even = 0, stick = 0, stops = 1;
+  unsigned int gap_cycles = 0;
+  std::deque<uint8_t> tx, rx;
+  // transmitter: frame shift register, bits left, cycles left in the bit
+  unsigned int tx_frame = 0, tx_nbits = 0, tx_cnt = 0, tx_gap = 0;
+  // receiver: sampled bits, bits left, cycles to the next sample
+  unsigned int rx_shift = 0, rx_idx = 0, rx_nbits = 0, rx_cnt = 0, rx_prev = 1;
+
+  unsigned int parity_bit(unsigned int data) {
+    if (stick)
+      return !even;
+    return __builtin_parity(data) ^ !even;
+  }
+
+  // start bit, data LSB first, parity, stop bits
+  void load(uint8_t c) {
+    unsigned int data = c & ((1 << bits) - 1);
+
+    tx_frame = data << 1;
+    tx_nbits = 1 + bits;
+    if (parity)
+      tx_frame |= parity_bit(data) << tx_nbits++;
+    tx_frame |= ((1 << stops) - 1) << tx_nbits;
+    tx_nbits += stops;
+  }
+
+  void tx_tick() {
+    if (tx_cnt) {
+      tx_cnt--;
+      return;
+    }
+    if (!tx_nbits) {
+      if (tx_gap) {
+        tx_gap--;
+        return;
+      }
+      if (tx.empty())
+        return;
+      load(tx.front());
+      tx.pop_front();
+    }
+    dut->line_rxd_i = tx_frame & 1;
+    tx_frame >>= 1;
+    tx_cnt = cpb - 1;
+    if (--tx_nbits == 0)
+      tx_gap = gap_cycles;
+  }
+
+  void rx_tick() {
+    unsigned int b = dut->line_txd_o;
+
+    if (!rx_nbits) {
+      // falling edge of the start bit; sample each bit in its middle
+      if (rx_prev && !b) {
+        rx_nbits = 1 + bits + parity + 1;
+        rx_cnt = cpb / 2;
+        rx_shift = rx_idx = 0;
+      }
+      rx_prev = b;
+      return;
+    }
+    rx_prev = b;
+    if (rx_cnt) {
+      rx_cnt--;
+      return;
+    }
+    rx_shift |= b << rx_idx++;
+    rx_cnt = cpb - 1;
+    if (--rx_nbits == 0 && !(rx_shift & 1))
+      rx.push_back((rx_shift >> 1) & ((1 << bits) - 1));
+  }
+};
+
+Rs232Line line;
+
+// Pseudo-terminal bridged to the line model (+pty): what is written to it is
+// sent to the RX of UART16550 #1, what that UART transmits can be read from
+// it. Terminal programs and serial tools open the printed path as a port.
+int pty_fd = -1;
+int pty_slave = -1;
+bool pty_on = false; // bridged, from iob_line_pty()
+vluint64_t pty_next = 0;
+
+// Clock cycles between PTY polls
+#define PTY_POLL_CYCLES 1024
+
+static void pty_open() {
+  struct termios t;
+
+  pty_fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (pty_fd < 0 || grantpt(pty_fd) || unlockpt(pty_fd)) {
+    perror("posix_openpt");
+    exit(1);
+  }
+  // keep the slave open, in raw mode, so clients can come and go
+  pty_slave = open(ptsname(pty_fd), O_RDWR | O_NOCTTY);
+  if (pty_slave < 0 || tcgetattr(pty_slave, &t)) {
+    perror("pty");
+    exit(1);
+  }
+  cfmakeraw(&t);
+  tcsetattr(pty_slave, TCSANOW, &t);
+  fcntl(pty_fd, F_SETFL, fcntl(pty_fd, F_GETFL) | O_NONBLOCK);
+  fprintf(stdout, "PTY: %s\n", ptsname(pty_fd));
+  fflush(stdout);
+}
+
+// Move data between the PTY and the line model
+static void pty_poll() {
+  uint8_t buf[256];
+  ssize_t n;
+
+  while ((n = read(pty_fd, buf, sizeof(buf))) > 0)
+    line.send(buf, n);
+  while ((n = line.recv(buf, sizeof(buf))) > 0)
+    if (write(pty_fd, buf, n) < 0)
+      break; // no client reading: drop
+}
+
+// Clock edge: toggle the clock and settle the model once. Inputs changed
+// since the last edge settle in the same eval; the design samples them on the
+// following posedge.
+static inline void clk_edge() {
+  dut->clk_i = !dut->clk_i;
+  dut->eval();
 #if (VM_TRACE == 1)
+  if (sim_time >= trace_start && sim_time < trace_stop)
     tfp->dump(sim_time); // Dump values into tracing file
 #endif
-    sim_time += CLK_PERIOD / 2;
-    dut->clk_i = !dut->clk_i; // negedge
-    dut->eval();
+  sim_time += CLK_PERIOD / 2;
+}
+
+// Clock tick: negedge then posedge, one eval each. Idle waits pass n > 1.
+void clk_tick(unsigned int n = 1) {
+  sim_cycles += n;
 #if (VM_TRACE == 1)
-    tfp->dump(sim_time);
+  if (sim_time + (vluint64_t)n * CLK_PERIOD > trace_start &&
+      sim_time < trace_stop) {
+    for (unsigned int i = 0; i < n; i++) {
+      clk_edge(); // negedge
+      clk_edge(); // posedge
+      if (line.enabled)
+        line.tick();
+    }
+  } else
 #endif
-    sim_time += CLK_PERIOD / 2;
-    dut->clk_i = !dut->clk_i; // posedge
-    dut->eval();
+  {
+    // untraced fast path: no dump, time advanced once
+    for (unsigned int i = 0; i < n; i++) {
+      dut->clk_i = 0;
+      dut->eval();
+      dut->clk_i = 1;
+      dut->eval();
+      if (line.enabled)
+        line.tick();
+    }
+    sim_time += (vluint64_t)n * CLK_PERIOD;
+  }
+  if (pty_on && sim_cycles >= pty_next) {
+    pty_next = sim_cycles + PTY_POLL_CYCLES;
+    pty_poll();
   }
 }
 
+// Value of plusarg +<name><value>, name including the '='
+static bool plusarg(const char *name, vluint64_t *value) {
+  const char *arg = Verilated::commandArgsPlusMatch(name);
+
+  if (!arg[0])
+    return false;
+  *value = strtoull(arg + 1 + strlen(name), NULL, 0);
+  return true;
+}
+
+#if (VM_TRACE == 1)
+// Open the trace window now, unless it is open already
+static void trace_trigger() {
+  if (sim_time >= trace_start && sim_time < trace_stop)
+    return;
+  if (sim_time >= trace_stop)
+    trace_stop = ~0ULL; // window closed: open a new one
+  trace_start = sim_time;
+  if (trace_post)
+    trace_stop = sim_time + trace_post * CLK_PERIOD;
+  fprintf(stdout, "Trace triggered at %llu\n", (unsigned long long)sim_time);
+}
+
+// Triggers on bus accesses
+static void trace_access(unsigned int address, unsigned int data, bool read) {
+  unsigned int offset = address & ((1 << IOB_UART16550_CSRS_CSRS_ADDR_W) - 1);
+
+  if (address == trace_addr)
+    trace_trigger();
+  else if (trace_on_error && read && offset == IOB_UART16550_CSRS_LS_ADDR &&
+           (data & 0x1E)) // OE, PE, FE or BI
+    trace_trigger();
+}
+
+// Set the trace window from the plusargs
+static void trace_args() {
+  vluint64_t v;
+  bool start = false;
+
+  if (plusarg("trace_start=", &v)) {
+    trace_start = v;
+    start = true;
+  }
+  if (plusarg("trace_start_cycle=", &v)) {
+    trace_start = v * CLK_PERIOD;
+    start = true;
+  }
+  if (plusarg("trace_stop=", &v))
+    trace_stop = v;
+  if (plusarg("trace_stop_cycle=", &v))
+    trace_stop = v * CLK_PERIOD;
+  if (plusarg("trace_addr=", &v))
+    trace_addr = v;
+  plusarg("trace_post=", &trace_post);
+  trace_on_error = Verilated::commandArgsPlusMatch("trace_on_error")[0];
+  trace_on_fail = Verilated::commandArgsPlusMatch("trace_on_fail")[0];
+  if (!start && (trace_addr != ~0U || trace_on_error || trace_on_fail))
+    trace_start = ~0ULL; // wait for a trigger
+}
+#endif
+
+// Bus-functional model of the IOb native manager. Requests go out back to
+// back, the next one driven in the cycle after the previous one is accepted,
+// with up to depth reads waiting for their rvalid; responses complete reads
+// in order. Set the depth with +bus_depth=<n>.
+class IobBfm {
+public:
+  unsigned int depth = 4;
+  vluint64_t cycles = 0; // clock cycles with requests outstanding
+
+  // Run ops to completion, read data returned in their value
+  void run(struct iob_uart16550_csrs_op *ops, unsigned int n) {
+    unsigned int next = 0;
+    bool issue, accepted;
+
+    bus_transactions += n;
+    while (next < n || !reads.empty()) {
+      issue = next < n && reads.size() < depth;
+      if (issue)
+        drive(ops[next]);
+      else
+        idle();
+      dut->eval(); // Some cores may change ready when they receive valid
+      accepted = issue && dut->iob_ready_o;
+      if (dut->iob_rvalid_o && !reads.empty()) {
+        complete(reads.front());
+        reads.pop_front();
+      }
+      clk_tick();
+      cycles++;
+      if (accepted) {
+        if (!ops[next].write)
+          reads.push_back(&ops[next]);
+        next++;
+      }
+    }
+    idle();
+  }
+
+private:
+  std::deque<struct iob_uart16550_csrs_op *> reads; // accepted, no rvalid
+
+  void drive(const struct iob_uart16550_csrs_op &op) {
+    unsigned int nbytes = op.data_w / 8 + (op.data_w % 8 ? 1 : 0);
+
+    dut->iob_addr_i = op.addr;
+    dut->iob_valid_i = 1;
+    if (!op.write) {
+      dut->iob_wstrb_i = 0;
+      return;
+    }
+#if (VM_TRACE == 1)
+    trace_access(op.addr, op.value, false);
+#endif
+    switch (nbytes) {
+    case 1:
+      dut->iob_wstrb_i = 0x1 << (op.addr & 0x3);
+      dut->iob_wdata_i = op.value << ((op.addr & 0x3) * 8);
+      break;
+    case 2:
+      dut->iob_wstrb_i = 0x3 << (op.addr & 0x2);
+      dut->iob_wdata_i = op.value << ((op.addr & 0x2) * 8);
+      break;
+    default:
+      dut->iob_wstrb_i = 0xF;
+      dut->iob_wdata_i = op.value;
+      break;
+    }
+  }
+
+  void idle() {
+    dut->iob_valid_i = 0;
+    dut->iob_wstrb_i = 0;
+  }
+
+  void complete(struct iob_uart16550_csrs_op *op) {
+    unsigned int nbytes = op->data_w / 8 + (op->data_w % 8 ? 1 : 0);
+
+    switch (nbytes) {
+    case 1:
+      op->value = (dut->iob_rdata_o >> ((op->addr & 0x3) * 8)) & 0xFF;
+      break;
+    case 2:
+      op->value = (dut->iob_rdata_o >> ((op->addr & 0x2) * 8)) & 0xFFFF;
+      break;
+    default:
+      op->value = dut->iob_rdata_o;
+      break;
+    }
+#if (VM_TRACE == 1)
+    trace_access(op->addr, op->value, true);
+#endif
+  }
+};
+
+IobBfm bfm;
+
+// Checkpoint of the model and harness state after reset and init, to start
+// later runs straight at the test body (needs --savable):
+//   +checkpoint_save=<file>     save when the core testbench reaches it
+//   +checkpoint_restore=<file>  restore instead of reset and init
+bool restored = false;
+
+#ifdef VLT_SAVABLE
+static const char *checkpoint_file(const char *name) {
+  const char *arg = Verilated::commandArgsPlusMatch(name);
+
+  return arg[0] ? arg + 1 + strlen(name) : NULL;
+}
+
+static void checkpoint_restore() {
+  const char *file = checkpoint_file("checkpoint_restore=");
+  VerilatedRestore os;
+
+  if (!file)
+    return;
+  os.open(file);
+  os >> sim_time >> sim_cycles >> bus_transactions >> bfm.cycles;
+  os >> *dut;
+  os.close();
+  restored = true;
+  fprintf(stdout, "Checkpoint restored from %s\n", file);
+}
+#endif
+
+// Core testbench reached the checkpoint
+void iob_checkpoint() {
+#ifdef VLT_SAVABLE
+  const char *file = checkpoint_file("checkpoint_save=");
+  VerilatedSave os;
+
+  if (!file)
+    return;
+  os.open(file);
+  os << sim_time << sim_cycles << bus_transactions << bfm.cycles;
+  os << *dut;
+  os.close();
+  fprintf(stdout, "Checkpoint saved to %s\n", file);
+#endif
+}
+
+// Whether the state was restored from a checkpoint, so the core testbench
+// skips what comes before it
+int iob_restore() { return restored; }
+
+// Failure reported by the core testbench
+void iob_trace_trigger() {
+#if (VM_TRACE == 1)
+  if (trace_on_fail)
+    trace_trigger();
+#endif
+}
+
 // Reset dut
 void iob_hard_reset() {
   dut->clk_i = 1;
@@ -78,83 +523,95 @@ void iob_hard_reset() {
 
 // Write data to IOb Native subordinate
 void iob_write(unsigned int address, unsigned data_w, unsigned int data) {
+  struct iob_uart16550_csrs_op op = {address, data_w, data, 1};
 
-  unsigned int nbytes = data_w / 8 + (data_w % 8 ? 1 : 0);
-
-  dut->iob_addr_i = address; // remove byte address
-  dut->iob_valid_i = 1;
-  switch (nbytes) {
-  case 1:
-    dut->iob_wstrb_i = 0x1 << (address & 0x3);
-    dut->iob_wdata_i = data << ((address & 0x3) * 8);
-    break;
-  case 2:
-    dut->iob_wstrb_i = 0x3 << (address & 0x2);
-    dut->iob_wdata_i = data << ((address & 0x2) * 8);
-    break;
-  default:
-    dut->iob_wstrb_i = 0xF;
-    dut->iob_wdata_i = data;
-    break;
-  }
-  dut->eval(); // Some cores may change ready when they receive valid
-  while (dut->iob_ready_o == 0) {
-    clk_tick();
-  }
-  clk_tick();
-  dut->iob_valid_i = 0;
-  dut->iob_wstrb_i = 0;
+  bfm.run(&op, 1);
 }
 
 // Read data from IOb Native subordinate
 unsigned int iob_read(unsigned int address, unsigned int data_w) {
+  struct iob_uart16550_csrs_op op = {address, data_w, 0, 0};
 
-  unsigned int nbytes = data_w / 8 + (data_w % 8 ? 1 : 0);
-  unsigned int data;
+  bfm.run(&op, 1);
+  return op.value;
+}
 
-  dut->iob_addr_i = address; // remove byte address
-  dut->iob_valid_i = 1;
-  dut->eval(); // Some cores may change ready when they receive valid
-  while (dut->iob_ready_o == 0) {
-    clk_tick();
-  }
-  clk_tick();
-  dut->iob_valid_i = 0;
-  while (dut->iob_rvalid_o == 0) {
+// Batch of accesses, pipelined by the BFM
+void iob_batch(struct iob_uart16550_csrs_op *ops, uint32_t n) {
+  bfm.run(ops, n);
+}
+
+// RS232 line model services; returns 1 as the model is available
+int iob_line_config(uint32_t cycles_per_bit, uint32_t lcr, uint32_t gap) {
+  line.config(cycles_per_bit, lcr, gap);
+  return 1;
+}
+
+void iob_line_send(const void *buf, uint32_t len) {
+  line.send((const uint8_t *)buf, len);
+}
+
+uint32_t iob_line_recv(void *buf, uint32_t len) {
+  return line.recv((uint8_t *)buf, len);
+}
+
+uint32_t iob_line_pending() { return line.pending(); }
+
+// Bridge the line model to the PTY, when one was opened with +pty
+int iob_line_pty() {
+  pty_on = pty_fd >= 0;
+  return pty_on;
+}
+
+// Number of bus transactions issued so far
+uint32_t iob_bus_transactions() { return bus_transactions; }
+
+// Let the clock run without bus traffic until an interrupt in mask is
+// asserted, as a core sleeping in WFI. Returns 0 on timeout.
+int iob_wait_irq(uint32_t mask) {
+  for (unsigned int i = 0; i < IRQ_TIMEOUT; i++) {
+    if (dut->interrupt_o & mask)
+      return 1;
     clk_tick();
   }
-  switch (nbytes) {
-  case 1:
-    data = (dut->iob_rdata_o >> ((address & 0x3) * 8)) & 0xFF;
-    break;
-  case 2:
-    data = (dut->iob_rdata_o >> ((address & 0x2) * 8)) & 0xFFFF;
-    break;
-  default:
-    data = dut->iob_rdata_o;
-    break;
-  }
-  clk_tick();
-  return data;
+  return 0;
 }
 
 int main(int argc, char **argv) {
 
   Verilated::commandArgs(argc, argv); // Init verilator context
+  vluint64_t v;
+  auto wall_start = std::chrono::steady_clock::now();
 
 #if (VM_TRACE == 1)
   Verilated::traceEverOn(true); // Enable tracing
   dut->trace(tfp, 1);
-  tfp->open("uut.vcd");
+  tfp->open(TRACE_FILE);
+  trace_args();
 #endif
 
-  // hardware reset
-  iob_hard_reset();
+  if (plusarg("bus_depth=", &v) && v)
+    bfm.depth = v;
+  if (Verilated::commandArgsPlusMatch("pty")[0])
+    pty_open();
+
+  // hardware reset, or the state after it from a checkpoint
+#ifdef VLT_SAVABLE
+  checkpoint_restore();
+#endif
+  if (!restored)
+    iob_hard_reset();
 
   //
   // CALL THE CORE TEST BENCH
   //
   int failed = iob_core_tb();
+  if (pty_fd >= 0) {
+    if (pty_on)
+      pty_poll(); // last characters decoded
+    close(pty_slave);
+    close(pty_fd);
+  }
 
   // create test log file
   FILE *log = fopen("test.log", "w");
@@ -168,9 +625,19 @@ int main(int argc, char **argv) {
   // terminate simulation and generate trace file
   dut->final();
 
+  // simulation rate
+  std::chrono::duration<double> wall =
+      std::chrono::steady_clock::now() - wall_start;
+  fprintf(stdout, "Simulated %llu cycles in %.2f s (%.0f cycles/s)\n",
+          (unsigned long long)sim_cycles, wall.count(),
+          wall.count() > 0 ? sim_cycles / wall.count() : 0.0);
+  fprintf(stdout, "Bus: %u transactions in %llu cycles (%.2f per cycle)\n",
+          bus_transactions, (unsigned long long)bfm.cycles,
+          bfm.cycles ? (double)bus_transactions / bfm.cycles : 0.0);
+
 #if (VM_TRACE == 1)
   tfp->close(); // Close tracing file
-  fprintf(stdout, "Trace file created: uut.vcd\n");
+  fprintf(stdout, "Trace file created: " TRACE_FILE "\n");
   delete tfp;
 #endif
 
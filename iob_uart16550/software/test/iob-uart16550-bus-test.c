@@ -0,0 +1,292 @@
+/*
+ * SPDX-FileCopyrightText: 2025 IObundle
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+// Bus transaction budgets of the driver and CSR entry points.
+//
+// Host-side test: iob_uart16550.c (built with UART16550_IOB_BUS) and
+// iob_uart16550_csrs.c are linked against the mock iob_read()/iob_write()
+// below, which counts every access and models a UART whose TX drains at once
+// plus a legacy console on the other end of the line. Each entry point must
+// stay within its budget of bus transactions.
+
+#include "iob_uart16550.h"
+#include "iob_uart16550_csrs.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define DRV_BASE (0x100)
+#define CSRS_BASE (0x200)
+
+#define FILE_SIZE (4096)
+
+// Bus transaction count
+static uint32_t bus_count = 0;
+
+// Mock UART registers
+static uint8_t lcr = 0x03, ier = 0, dll = 0, dlm = 0;
+
+// RX FIFO contents, pushed by the console model
+static uint8_t rx_data[2 * FILE_SIZE];
+static uint32_t rx_head = 0, rx_tail = 0;
+
+// Console model: answers ENQ with ACK, serves FRX and absorbs FTX
+enum { CNSL_IDLE, CNSL_NAME, CNSL_ACK, CNSL_SIZE, CNSL_DATA };
+static int cnsl_state = CNSL_IDLE;
+static uint8_t cnsl_cmd;
+static uint32_t cnsl_cnt, cnsl_size;
+static char file_tx[FILE_SIZE], file_rx[FILE_SIZE];
+
+static void rx_push(const void *buf, uint32_t len) {
+  memcpy(rx_data + rx_head, buf, len);
+  rx_head += len;
+}
+
+static uint32_t rx_count() {
+  uint32_t n = rx_head - rx_tail;
+  return (n > UART16550_FIFO_DEPTH) ? UART16550_FIFO_DEPTH : n;
+}
+
+static void cnsl_putc(uint8_t c) {
+  uint8_t size_le[4];
+
+  switch (cnsl_state) {
+  case CNSL_IDLE:
+    if (c == ENQ) {
+      size_le[0] = ACK;
+      rx_push(size_le, 1);
+    } else if (c == FRX || c == FTX) {
+      cnsl_cmd = c;
+      cnsl_state = CNSL_NAME;
+    }
+    break;
+  case CNSL_NAME:
+    if (c)
+      break;
+    if (cnsl_cmd == FRX) {
+      size_le[0] = FILE_SIZE & 0xFF;
+      size_le[1] = (FILE_SIZE >> 8) & 0xFF;
+      size_le[2] = size_le[3] = 0;
+      rx_push(size_le, 4);
+      cnsl_state = CNSL_ACK;
+    } else {
+      cnsl_cnt = cnsl_size = 0;
+      cnsl_state = CNSL_SIZE;
+    }
+    break;
+  case CNSL_ACK:
+    if (c == ACK) {
+      rx_push(file_tx, FILE_SIZE);
+      cnsl_state = CNSL_IDLE;
+    }
+    break;
+  case CNSL_SIZE:
+    cnsl_size |= (uint32_t)c << (8 * cnsl_cnt);
+    if (++cnsl_cnt == 4) {
+      cnsl_cnt = 0;
+      cnsl_state = cnsl_size ? CNSL_DATA : CNSL_IDLE;
+    }
+    break;
+  case CNSL_DATA:
+    file_rx[cnsl_cnt++] = c;
+    if (cnsl_cnt == cnsl_size)
+      cnsl_state = CNSL_IDLE;
+    break;
+  }
+}
+
+void iob_write(uint32_t addr, uint32_t data_w, uint32_t value) {
+  uint8_t dlab = lcr >> 7;
+
+  bus_count++;
+  switch (addr & 0x1F) {
+  case 0:
+    if (dlab)
+      dll = value;
+    else if ((addr & ~0x1F) == DRV_BASE)
+      cnsl_putc(value);
+    break;
+  case 1:
+    if (dlab)
+      dlm = value;
+    else
+      ier = value;
+    break;
+  case 3:
+    lcr = value;
+    break;
+  }
+}
+
+uint32_t iob_read(uint32_t addr, uint32_t data_w) {
+  uint8_t dlab = lcr >> 7;
+
+  bus_count++;
+  switch (addr & 0x1F) {
+  case 0:
+    if (dlab)
+      return dll;
+    return (rx_tail < rx_head) ? rx_data[rx_tail++] : 0;
+  case 1:
+    return dlab ? dlm : ier;
+  case 2:
+    return 0xC1; // no interrupt pending
+  case 3:
+    return lcr;
+  case 5:
+    return 0x60 | (rx_tail < rx_head); // TX empty, data ready
+  case 8:
+    return ((uint32_t)lcr << 16) | ((uint32_t)ier << 8) | 0x60;
+  case 12:
+    return rx_count() << 16;
+  }
+  return 0;
+}
+
+static int fail_cnt = 0;
+
+// Check the transactions since start against budget
+static void check(const char *name, uint32_t start, uint32_t budget) {
+  uint32_t n = bus_count - start;
+
+  printf("\t%-28s %6u transactions (budget %u)\n", name, n, budget);
+  if (n > budget) {
+    printf("Error: %s over budget\n", name);
+    fail_cnt++;
+  }
+}
+
+static void test_driver() {
+  struct uart16550_dev dev;
+  uint32_t t, i;
+  char buf[UART16550_FIFO_DEPTH];
+
+  printf("Driver:\n");
+
+  // LCR read, DLAB on, DLM, DLL, DLAB off, FCR, IER
+  t = bus_count;
+  uart16550_dev_init(&dev, DRV_BASE, 10);
+  check("init", t, 7);
+
+  // the credit of one DB2 read covers a TX FIFO worth of putc
+  t = bus_count;
+  uart16550_dev_putc(&dev, 'a');
+  check("putc", t, 2);
+  t = bus_count;
+  for (i = 0; i < 10 * UART16550_FIFO_DEPTH; i++)
+    uart16550_dev_putc(&dev, 'a');
+  check("putc x 2560", t, 10 * UART16550_FIFO_DEPTH + 10);
+
+  // ring output left with no ISR running goes out ahead of a blocking send:
+  // IER, LSR and THR for the ring, LSR and THR for the character
+  uart16550_dev_putc_nb(&dev, 'a');
+  t = bus_count;
+  uart16550_dev_putc(&dev, 'a');
+  check("putc after putc_nb", t, 5);
+
+  // LSR, RB
+  rx_push("b", 1);
+  t = bus_count;
+  uart16550_dev_getc(&dev);
+  check("getc", t, 2);
+
+  // a FIFO of data: one LSR read per burst, one DB2 read per drain
+  t = bus_count;
+  uart16550_dev_write(&dev, buf, sizeof(buf));
+  check("write 256", t, UART16550_FIFO_DEPTH + 1);
+  rx_push(buf, sizeof(buf));
+  t = bus_count;
+  uart16550_dev_read(&dev, buf, sizeof(buf));
+  check("read 256", t, UART16550_FIFO_DEPTH + 1);
+}
+
+static void test_file() {
+  struct uart16550_dev dev;
+  uint32_t t, i;
+
+  printf("File transfer (%d bytes):\n", FILE_SIZE);
+
+  for (i = 0; i < FILE_SIZE; i++)
+    file_tx[i] = 'a' + i % 26;
+  uart16550_dev_init(&dev, DRV_BASE, 10);
+
+  // about one access per byte, plus 1/256 for the FIFO level reads; the
+  // messages, probe and file name take the rest
+  t = bus_count;
+  uart16550_dev_recvfile(&dev, "f", file_rx);
+  check("recvfile", t, FILE_SIZE + FILE_SIZE / 128 + 200);
+  if (memcmp(file_rx, file_tx, FILE_SIZE)) {
+    printf("Error: recvfile data mismatch\n");
+    fail_cnt++;
+  }
+
+  memset(file_rx, 0, FILE_SIZE);
+  t = bus_count;
+  uart16550_dev_sendfile(&dev, "f", FILE_SIZE, file_tx);
+  check("sendfile", t, FILE_SIZE + FILE_SIZE / 128 + 200);
+  if (memcmp(file_rx, file_tx, FILE_SIZE)) {
+    printf("Error: sendfile data mismatch\n");
+    fail_cnt++;
+  }
+}
+
+static void test_csrs() {
+  struct iob_uart16550_snapshot s;
+  uint32_t t;
+
+  printf("CSRs:\n");
+
+  iob_uart16550_csrs_init_baseaddr(CSRS_BASE);
+
+  // the shadow LCR is loaded once, DLAB is set and cleared around each DL
+  t = bus_count;
+  iob_uart16550_csrs_set_dl1(10);
+  iob_uart16550_csrs_set_dl2(0);
+  iob_uart16550_csrs_set_fc(0xC0);
+  iob_uart16550_csrs_set_ie(0x03);
+  check("init", t, 9);
+
+  t = bus_count;
+  iob_uart16550_csrs_set_tr('a');
+  check("set_tr", t, 1);
+  t = bus_count;
+  iob_uart16550_csrs_get_rb();
+  check("get_rb", t, 1);
+  t = bus_count;
+  iob_uart16550_csrs_get_ls();
+  check("get_ls", t, 1);
+  t = bus_count;
+  iob_uart16550_csrs_get_lc();
+  check("get_lc", t, 0);
+
+  // switching instances keeps their shadow LCR
+  iob_uart16550_csrs_init_baseaddr(DRV_BASE);
+  iob_uart16550_csrs_get_lc();
+  iob_uart16550_csrs_init_baseaddr(CSRS_BASE);
+  t = bus_count;
+  iob_uart16550_csrs_get_rb();
+  check("get_rb after base switch", t, 1);
+
+  t = bus_count;
+  iob_uart16550_snapshot(&s);
+  check("snapshot", t, 2);
+}
+
+int main() {
+  printf("IOB UART16550 bus transaction budgets\n");
+
+  test_driver();
+  test_file();
+  test_csrs();
+
+  if (fail_cnt) {
+    printf("%d budget(s) exceeded\n", fail_cnt);
+    return 1;
+  }
+  printf("All budgets met\n");
+  return 0;
+}